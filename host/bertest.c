@@ -0,0 +1,425 @@
+/**
+* @file bertest.c
+*
+* @brief Bit and frame error rate measurement from PRBS test frames
+*
+* Usage:
+*   bertest -f <recording> [-b baud]
+*       Analyses raw bytes recorded from the IR receiver while the beacon was in PRBS
+*       test mode ('p' in TaskUI). 'baud' only labels the result and sets the throughput.
+*   bertest -R <receiver tty> -C <console tty> [-d secs] [-w secs]
+*       Live sweep: switches the beacon to PRBS mode over the console, steps it through
+*       every rate of baud[][] with 'z' and 'a' (decreaseBaud()/increaseBaud()), and
+*       measures each rate for 'd' seconds (default 30) after a settling time 'w'
+*       (default 1). The receiver port is reconfigured to match each rate.
+*
+* PRBS and TDMA ('t') may be on together: the beacon then steps a side's LFSR only after
+* the frames it actually sent, so the sequence of each side is unbroken across its slots.
+* payload_bps then drops to the TDMA frame rate, and the slots in which the locked side is
+* silent do not count as lost frames.
+*
+* In PRBS mode every side sends the successive states of its own LFSR (LinkPrbsNext()),
+* so each byte predicts the next one and identifies its side. The analyser locks onto a
+* side, and for every byte compares it with the prediction from the last trusted byte:
+* - equal: a good frame;
+* - equal to the prediction one step further: a frame was lost;
+* - otherwise the byte is held until the next one arrives. If the next byte continues the
+*   locked sequence, the held byte was corrupted and its differing bits are counted.
+*   If it continues another side's sequence from the held byte, the receiver moved to
+*   another face. Anything else drops the lock and the bytes count as unsynced.
+*
+* Build: cc -O2 -o bertest bertest.c link.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>               // Req'd because we call getopt() and read()
+#include <fcntl.h>                // Req'd because we call open()
+#include <termios.h>              // Req'd because we call cfsetspeed()
+#include <time.h>                 // Req'd because we call clock_gettime()
+
+#include "link.h"                 // Req'd because we call LinkPrbsNext()
+
+#define CONSOLE_BAUD          B9600
+#define READ_BUFFER_SIZE      4096
+#define REPLY_TIMEOUT_S       3.0
+
+typedef struct {
+  unsigned long frames;       // Frames whose content was checked
+  unsigned long bitErrors;
+  unsigned long frameErrors;  // Checked frames with at least one bit error
+  unsigned long lost;         // Frames missing from an otherwise intact sequence
+} SideStats;
+
+typedef struct {
+  SideStats side[LINK_SIDES];
+  unsigned long bytes;
+  unsigned long unsynced;     // Bytes that could not be attributed to a side
+  int  lock;                  // Locked side, -1 if none
+  int  held;                  // A byte is waiting for confirmation
+  unsigned char last;         // Last trusted byte of the locked side
+  unsigned char hold;         // The held byte
+} Ber;
+
+/**
+popcount8()
+*/
+static unsigned popcount8 ( unsigned char b )
+{
+  return (unsigned) __builtin_popcount(b);
+}
+
+/**
+findSide()
+
+@return Side whose sequence goes from 'a' to 'b', preferring 'pref'; -1 if none.
+*/
+static int findSide ( unsigned char a, unsigned char b, int pref )
+{
+  int s;
+
+  if (pref >= 0 && LinkPrbsNext((unsigned) pref, a) == b) {
+    return pref;
+  }
+  for (s = 0; s < LINK_SIDES; s++) {
+    if (LinkPrbsNext((unsigned) s, a) == b) {
+      return s;
+    }
+  }
+  return -1;
+}
+
+/**
+berFeed()
+
+Adds one received byte to the analysis.
+*/
+static void berFeed ( Ber *b, unsigned char c )
+{
+  unsigned char p, pp;
+  SideStats *st;
+  int s;
+
+  b->bytes++;
+
+  if (b->lock < 0) {
+    if (b->held && (s = findSide(b->hold, c, -1)) >= 0) {
+      b->lock = s;
+      b->last = c;
+      b->held = 0;
+      b->side[s].frames += 2;
+    } else {
+      b->unsynced += b->held;
+      b->hold = c;
+      b->held = 1;
+    }
+    return;
+  }
+
+  st = &b->side[b->lock];
+  p  = LinkPrbsNext((unsigned) b->lock, b->last);
+  pp = LinkPrbsNext((unsigned) b->lock, p);
+
+  if (b->held) {
+    b->held = 0;
+    if (c == pp) {
+      // Held byte was a corrupted 'p'
+      st->frames += 2;
+      st->frameErrors++;
+      st->bitErrors += popcount8(b->hold ^ p);
+      b->last = c;
+    } else if ((s = findSide(b->hold, c, -1)) >= 0) {
+      // Receiver moved to another face
+      b->lock = s;
+      b->side[s].frames += 2;
+      b->last = c;
+    } else {
+      b->lock = -1;
+      b->unsynced++;
+      b->hold = c;
+      b->held = 1;
+    }
+    return;
+  }
+
+  if (c == p) {
+    st->frames++;
+    b->last = c;
+  } else if (c == pp) {
+    st->frames++;
+    st->lost++;
+    b->last = c;
+  } else {
+    b->hold = c;
+    b->held = 1;
+  }
+}
+
+/**
+berReport()
+
+Prints one result row and one row per side.
+*/
+static void berReport ( const Ber *b, unsigned baud, double secs )
+{
+  unsigned long frames = 0, bitErrors = 0, frameErrors = 0, lost = 0;
+  int s;
+
+  for (s = 0; s < LINK_SIDES; s++) {
+    frames      += b->side[s].frames;
+    bitErrors   += b->side[s].bitErrors;
+    frameErrors += b->side[s].frameErrors;
+    lost        += b->side[s].lost;
+  }
+  printf("%5u %7.1f %9lu %11.1f %11.3e %11.3e %7lu %8lu\n", baud, secs, b->bytes,
+         secs > 0 ? (frames - frameErrors) * 8.0 / secs : 0,
+         frames ? (double) bitErrors / (frames * 8.0) : 0,
+         frames ? (double) frameErrors / frames : 0, lost, b->unsynced);
+  for (s = 0; s < LINK_SIDES; s++) {
+    if (b->side[s].frames) {
+      printf("   side %c: %9lu frames, BER %.3e, FER %.3e, %lu lost\n", linkSideChars[s],
+             b->side[s].frames, (double) b->side[s].bitErrors / (b->side[s].frames * 8.0),
+             (double) b->side[s].frameErrors / b->side[s].frames, b->side[s].lost);
+    }
+  }
+}
+
+static void berHeader ( void )
+{
+  printf(" baud    secs     bytes payload_bps         BER         FER    lost unsynced\n");
+}
+
+static void berInit ( Ber *b )
+{
+  memset(b, 0, sizeof(*b));
+  b->lock = -1;
+}
+
+/**
+now()
+
+@return Monotonic time in seconds.
+*/
+static double now ( void )
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+openTty()
+
+Opens a serial port raw, 8N1, at 'speed'.
+*/
+static int openTty ( const char *path, speed_t speed )
+{
+  struct termios tio;
+  int fd;
+
+  if ((fd = open(path, O_RDWR | O_NOCTTY)) < 0 || tcgetattr(fd, &tio) < 0) {
+    perror(path);
+    return -1;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN]  = 0;
+  tio.c_cc[VTIME] = 1;
+  cfsetspeed(&tio, speed);
+  if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static speed_t ttySpeed ( unsigned baud )
+{
+  switch (baud) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    default:   return B9600;
+  }
+}
+
+/**
+command()
+
+Sends a single-letter command and waits for a console reply containing 'expect'.
+
+@return 1 if 'expect' was seen, 0 if 'alt' was seen, -1 on timeout.
+*/
+static int command ( int fd, char cmd, const char *expect, const char *alt )
+{
+  char buf[1024];
+  size_t len = 0;
+  ssize_t n;
+  double end = now() + REPLY_TIMEOUT_S;
+
+  tcflush(fd, TCIFLUSH);
+  if (write(fd, &cmd, 1) != 1) {
+    perror("console");
+    return -1;
+  }
+  while (now() < end) {
+    if ((n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+      len += (size_t) n;
+      buf[len] = '\0';
+      if (strstr(buf, expect)) {
+        return 1;
+      }
+      if (alt && strstr(buf, alt)) {
+        return 0;
+      }
+      if (len > sizeof(buf) / 2) {
+        memmove(buf, buf + len / 2, len - len / 2 + 1);
+        len -= len / 2;
+      }
+    }
+  }
+  fprintf(stderr, "console: no reply to '%c'\n", cmd);
+  return -1;
+}
+
+/**
+measure()
+
+Reads the receiver for 'secs' seconds into a fresh analysis.
+*/
+static void measure ( int fd, Ber *b, double secs )
+{
+  unsigned char buf[READ_BUFFER_SIZE];
+  double end = now() + secs;
+  ssize_t n, i;
+
+  berInit(b);
+  tcflush(fd, TCIFLUSH);
+  while (now() < end) {
+    if ((n = read(fd, buf, sizeof(buf))) > 0) {
+      for (i = 0; i < n; i++) {
+        berFeed(b, buf[i]);
+      }
+    }
+  }
+}
+
+/**
+sweep()
+
+Live measurement over every rate of the beacon's baud table.
+*/
+static int sweep ( const char *rxPath, const char *conPath, double secs, double settle )
+{
+  struct termios tio;
+  Ber b;
+  int rx, con, k, rc;
+
+  if ((con = openTty(conPath, CONSOLE_BAUD)) < 0 || (rx = openTty(rxPath, B9600)) < 0) {
+    return 1;
+  }
+
+  // PRBS on ('p' toggles, so press again if it reports off)
+  if ((rc = command(con, 'p', "PRBS test frames on", "PRBS test frames off")) == 0) {
+    rc = command(con, 'p', "PRBS test frames on", NULL);
+  }
+  if (rc < 0) {
+    return 1;
+  }
+
+  // Down to the lowest rate
+  for (k = 0; k < LINK_BAUD_RATES - 1; k++) {
+    if (command(con, 'z', "Baud rate", NULL) < 0) {
+      return 1;
+    }
+  }
+
+  berHeader();
+  for (k = 0; k < LINK_BAUD_RATES; k++) {
+    if (k > 0 && command(con, 'a', "Baud rate", NULL) < 0) {
+      return 1;
+    }
+    tcgetattr(rx, &tio);
+    cfsetspeed(&tio, ttySpeed(linkBaud[k]));
+    tcsetattr(rx, TCSANOW, &tio);
+    usleep((useconds_t) (settle * 1e6));
+
+    measure(rx, &b, secs);
+    berReport(&b, linkBaud[k], secs);
+    fflush(stdout);
+  }
+
+  // Back to the power-up rate with fixed characters
+  for (k = LINK_BAUD_RATES - 1; k > LINK_DEFAULT_BAUD; k--) {
+    command(con, 'z', "Baud rate", NULL);
+  }
+  command(con, 'p', "PRBS test frames off", NULL);
+
+  close(rx);
+  close(con);
+  return 0;
+}
+
+/**
+analyseFile()
+
+Offline analysis of a recorded byte stream at a single rate.
+*/
+static int analyseFile ( const char *path, unsigned baud )
+{
+  unsigned char buf[READ_BUFFER_SIZE];
+  size_t n, i;
+  FILE *f;
+  Ber b;
+
+  if ((f = fopen(path, "rb")) == NULL) {
+    perror(path);
+    return 1;
+  }
+  berInit(&b);
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    for (i = 0; i < n; i++) {
+      berFeed(&b, buf[i]);
+    }
+  }
+  fclose(f);
+
+  // Duration from the beacon's frame rate, as a recording carries no timing
+  berHeader();
+  berReport(&b, baud, b.bytes * LinkFramePeriod(baud, LINK_GAP_TICKS));
+  return 0;
+}
+
+int main ( int argc, char **argv )
+{
+  const char *file = NULL, *rx = NULL, *con = NULL;
+  unsigned baud = linkBaud[LINK_DEFAULT_BAUD];
+  double secs = 30, settle = 1;
+  int opt, usage = 0;
+
+  while ((opt = getopt(argc, argv, "f:b:R:C:d:w:")) != -1) {
+    switch (opt) {
+      case 'f': file = optarg; break;
+      case 'b': baud = (unsigned) atoi(optarg); break;
+      case 'R': rx = optarg; break;
+      case 'C': con = optarg; break;
+      case 'd': secs = atof(optarg); break;
+      case 'w': settle = atof(optarg); break;
+      default:  usage = 1; break;
+    }
+  }
+
+  if (!usage && file && !rx && !con && baud) {
+    return analyseFile(file, baud);
+  }
+  if (!usage && !file && rx && con && secs > 0) {
+    return sweep(rx, con, secs, settle);
+  }
+  fprintf(stderr, "usage: bertest -f <recording> [-b baud]\n"
+                  "       bertest -R <receiver tty> -C <console tty> [-d secs] [-w secs]\n"
+                  "PRBS with TDMA on ('t') is supported: each side's LFSR steps only in its own slots.\n");
+  return 2;
+}
@@ -0,0 +1,273 @@
+/**
+* @file captool.c
+*
+* @brief Converts ground-station text logs to the binary capture format and reads captures back
+*
+* Usage:
+*   captool convert <log.txt> <out.cap> [chars]
+*                                           Text log to capture (appends if out.cap exists);
+*                                           'chars' are the beacon's side characters, four
+*                                           characters or its config.h (default xcVM)
+*   captool info <file.cap>                 Block count, record count and time span
+*   captool dump <file.cap> [from [to]]     Records between 'from' and 'to' seconds
+*
+* Text logs hold lines of the form
+*          1:hh:mm:ss.ttt xxxxcccVVVMM
+* i.e. the MsgTS() timestamp followed by the raw characters received. Characters on lines
+* without a timestamp are spread evenly between the stamps around them and flagged
+* CAP_FLAG_SYNTH_TIME. Appending continues the capture's clock and sequence numbers.
+* Lines whose payload contains a tab or ':' are console messages (e.g. "TaskPeriodic:\t...")
+* and are skipped.
+*
+* Build: cc -O2 -o captool captool.c capture.c craft.c link.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "capture.h"              // Req'd because we call CapAppend() and CapSeek()
+#include "craft.h"                // Req'd because we call CraftCharsFromSpec()
+#include "link.h"                 // Req'd because we call LinkSideOf()
+
+#define LINE_BUFFER_SIZE      4096
+
+// MsgTS() prints hours modulo 60, so its clock wraps every 60 hours.
+#define MSGTS_WRAP_US         (60LL*3600*1000000)
+
+/**
+parseStamp()
+
+Parses a leading "1:hh:mm:ss.ttt " timestamp.
+
+@param  line is the text line.
+@param  t_us receives the time in microseconds.
+@return Pointer to the text following the timestamp, or NULL if there is none.
+*/
+static const char *parseStamp ( const char *line, int64_t *t_us )
+{
+  unsigned int port, h, m, s, ms;
+  int used = 0;
+
+  if (sscanf(line, "%u:%2u:%2u:%2u.%3u%n", &port, &h, &m, &s, &ms, &used) != 5 || used == 0) {
+    return NULL;
+  }
+  *t_us = ((((int64_t) h*60 + m)*60 + s)*1000 + ms)*1000;
+  line += used;
+  if (*line == ' ') {
+    line++;
+  }
+  return line;
+}
+
+/**
+flushUntimed()
+
+Appends the records of untimed lines, spread evenly between the stamps around them.
+
+@param  w is the capture being written.
+@param  r holds the records, each with its t_us still unset.
+@param  n is the number of records.
+@param  t0 is the stamp before them.
+@param  t1 is the stamp after them (t0 if there is none).
+@return 0, or -1 if a record could not be appended.
+*/
+static int flushUntimed ( CapWriter *w, CapRecord *r, size_t n, int64_t t0, int64_t t1 )
+{
+  size_t k;
+
+  for (k = 0; k < n; k++) {
+    r[k].t_us = t0 + (t1 - t0) * (int64_t) (k + 1) / (int64_t) (n + 1);
+    if (CapAppend(w, &r[k]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+convert()
+
+Reads a text log and appends one record per received character.
+
+Appending to an existing capture continues its clock and sequence numbers: the MsgTS()
+clock is unwrapped from the capture's last time onwards, and seq from its record count.
+Characters on untimed lines are held back until the next stamp and then interpolated
+(flushUntimed()); those before the first stamp take the first stamp, those after the
+last take the last.
+*/
+static int convert ( const char *in, const char *out )
+{
+  char line[LINE_BUFFER_SIZE];
+  const char *p;
+  FILE *f;
+  CapWriter w;
+  CapRecord r, *untimed = NULL;
+  size_t nUntimed = 0, untimedSize = 0;
+  int64_t t = 0, stamp, offset = 0, last = 0;
+  unsigned long lines = 0, records = 0;
+  uint32_t seq;
+  int stamped = 0, timed, rc = 0;
+
+  if ((f = fopen(in, "r")) == NULL) {
+    perror(in);
+    return 1;
+  }
+  if (CapOpenWrite(&w, out, 0) < 0) {
+    fclose(f);
+    return 1;
+  }
+  // Continue the capture being appended to
+  if (w.tLast != INT64_MIN) {
+    last = w.tLast;
+    offset = last / MSGTS_WRAP_US * MSGTS_WRAP_US;
+  }
+  seq = w.total;
+
+  while (fgets(line, sizeof(line), f) && rc == 0) {
+    lines++;
+    if ((p = parseStamp(line, &stamp)) != NULL) {
+      // Unwrap the MsgTS() clock so that time never runs backwards.
+      while (stamp + offset < last) {
+        offset += MSGTS_WRAP_US;
+      }
+      last = stamp + offset;
+      rc = flushUntimed(&w, untimed, nUntimed, stamped ? t : last, last);
+      nUntimed = 0;
+      t = last;
+      stamped = timed = 1;
+    } else {
+      p = line;
+      timed = 0;
+    }
+
+    if (strpbrk(p, "\t:")) {
+      continue;
+    }
+
+    for (; *p && rc == 0; p++) {
+      if (*p == '\r' || *p == '\n' || *p == ' ') {
+        continue;
+      }
+      r.t_us  = t;
+      r.seq   = seq++;
+      r.ch    = (uint8_t) *p;
+      r.side  = (uint8_t) LinkSideOf(r.ch);
+      r.flags = r.side == LINK_SIDE_NONE ? CAP_FLAG_UNKNOWN : 0;
+      records++;
+      if (timed) {
+        rc = CapAppend(&w, &r);
+        continue;
+      }
+      // Hold untimed characters until the next stamp
+      r.flags |= CAP_FLAG_SYNTH_TIME;
+      if (nUntimed == untimedSize) {
+        untimedSize = untimedSize ? 2 * untimedSize : 1024;
+        if ((untimed = realloc(untimed, untimedSize * sizeof(CapRecord))) == NULL) {
+          perror("captool");
+          rc = -1;
+          break;
+        }
+      }
+      untimed[nUntimed++] = r;
+    }
+  }
+  if (rc == 0) {
+    rc = flushUntimed(&w, untimed, nUntimed, t, t);
+  }
+  free(untimed);
+
+  fclose(f);
+  if (CapClose(&w) < 0) {
+    rc = -1;
+  }
+  fprintf(stderr, "%s: %lu lines, %lu records\n", out, lines, records);
+  return rc ? 1 : 0;
+}
+
+/**
+info()
+
+Prints a summary of a capture using only its footers.
+*/
+static int info ( const char *path )
+{
+  CapReader rd;
+  unsigned long long records = 0;
+  size_t b;
+
+  if (CapOpenRead(&rd, path) < 0) {
+    return 1;
+  }
+  for (b = 0; b < rd.blocks; b++) {
+    records += CapBlockFooter(&rd, b)->count;
+  }
+  printf("blocks:  %zu\n", rd.blocks);
+  printf("records: %llu\n", records);
+  if (rd.blocks) {
+    printf("span:    %.6f .. %.6f s\n",
+           CapBlockFooter(&rd, 0)->tFirst / 1e6,
+           CapBlockFooter(&rd, rd.blocks-1)->tLast / 1e6);
+  }
+  CapCloseRead(&rd);
+  return 0;
+}
+
+/**
+dump()
+
+Prints the records in a time window, seeking straight to its start.
+*/
+static int dump ( const char *path, double from, double to )
+{
+  CapReader rd;
+  const CapRecord *r;
+  uint32_t i, n;
+  size_t b;
+  int64_t end = (int64_t) (to * 1e6);
+
+  if (CapOpenRead(&rd, path) < 0) {
+    return 1;
+  }
+  for (b = CapSeek(&rd, (int64_t) (from * 1e6), &i); b < rd.blocks; b++, i = 0) {
+    r = CapBlock(&rd, b, &n);
+    for (; i < n; i++) {
+      if (r[i].t_us > end) {
+        CapCloseRead(&rd);
+        return 0;
+      }
+      printf("%.6f %10u %c side=%-3d flags=0x%04x\n", r[i].t_us / 1e6, r[i].seq,
+             isprint(r[i].ch) ? r[i].ch : '.',
+             r[i].side == LINK_SIDE_NONE ? -1 : r[i].side, r[i].flags);
+    }
+  }
+  CapCloseRead(&rd);
+  return 0;
+}
+
+int main ( int argc, char **argv )
+{
+  unsigned char chars[LINK_SIDES];
+
+  if ((argc == 4 || argc == 5) && strcmp(argv[1], "convert") == 0) {
+    if (argc == 5) {
+      if (CraftCharsFromSpec(argv[4], chars) < 0) {
+        return 2;
+      }
+      LinkSetSideChars(chars);
+    }
+    return convert(argv[2], argv[3]);
+  }
+  if (argc == 3 && strcmp(argv[1], "info") == 0) {
+    return info(argv[2]);
+  }
+  if (argc >= 3 && argc <= 5 && strcmp(argv[1], "dump") == 0) {
+    return dump(argv[2], argc > 3 ? atof(argv[3]) : -1e12, argc > 4 ? atof(argv[4]) : 1e12);
+  }
+
+  fprintf(stderr, "usage: captool convert <log.txt> <out.cap> [chars]\n"
+                  "       captool info <file.cap>\n"
+                  "       captool dump <file.cap> [from_s [to_s]]\n");
+  return 2;
+}
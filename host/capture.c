@@ -0,0 +1,380 @@
+/**
+* @file capture.c
+*
+* @brief Append-only writer and memory-mapped reader for side event captures
+*
+* Records are buffered one block at a time and written together with their footer.
+* Readers map the file read-only and hand out pointers straight into the mapping.
+* Records must be appended in non-decreasing time order, which is what makes the
+* per-block time ranges usable for CapSeek().
+*
+* @note See capture.h for the file layout.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>                // Req'd because we call open()
+#include <unistd.h>               // Req'd because we call write() and ftruncate()
+#include <sys/mman.h>             // Req'd because we call mmap()
+#include <sys/stat.h>             // Req'd because we call fstat()
+
+#include "capture.h"              // Good to self-reference
+
+static uint32_t crcTable[256];
+static int crcReady = 0;
+
+/**
+CapCrc32()
+
+Standard reflected CRC-32 (polynomial 0xEDB88320), table driven.
+
+@param  crc is the running CRC, 0 for a new computation.
+@param  data points to the bytes to add.
+@param  len is the number of bytes.
+@return Updated CRC.
+*/
+uint32_t CapCrc32 ( uint32_t crc, const void *data, size_t len )
+{
+  const unsigned char *p = data;
+  uint32_t c;
+  unsigned int i, k;
+
+  if (!crcReady) {
+    for (i = 0; i < 256; i++) {
+      c = i;
+      for (k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+      }
+      crcTable[i] = c;
+    }
+    crcReady = 1;
+  }
+
+  crc = ~crc;
+  while (len--) {
+    crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+/**
+footerCrc()
+
+CRC of a block's record area plus every footer field preceding 'crc'.
+*/
+static uint32_t footerCrc ( const CapRecord *records, const CapFooter *f )
+{
+  uint32_t crc = CapCrc32(0, records, CAP_BLOCK_RECORDS*sizeof(CapRecord));
+  return CapCrc32(crc, f, offsetof(CapFooter, crc));
+}
+
+/**
+blockValid()
+
+Checks that block 'b' of a mapped file carries an intact footer.
+*/
+static int blockValid ( const unsigned char *map, size_t b )
+{
+  const unsigned char *base = map + CAP_HEADER_SIZE + b*CAP_BLOCK_SIZE;
+  const CapRecord *records = (const CapRecord *) base;
+  const CapFooter *f = (const CapFooter *) (base + CAP_BLOCK_RECORDS*sizeof(CapRecord));
+
+  return f->magic == CAP_FOOTER_MAGIC
+      && f->count > 0 && f->count <= CAP_BLOCK_RECORDS
+      && f->block == b
+      && f->crc == footerCrc(records, f);
+}
+
+/**
+CapOpenRead()
+
+Maps a capture file and determines how many blocks are valid.
+Only the tail is checked: in an append-only file a torn write can only affect the
+last blocks, so trailing blocks are dropped until one with an intact footer is found.
+
+@param  rd is the reader to initialize.
+@param  path is the capture file.
+@return 0 on success, -1 on error (message printed to stderr).
+*/
+int CapOpenRead ( CapReader *rd, const char *path )
+{
+  struct stat st;
+  int fd;
+
+  memset(rd, 0, sizeof(*rd));
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    perror(path);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < CAP_HEADER_SIZE) {
+    fprintf(stderr, "%s: not a capture file\n", path);
+    close(fd);
+    return -1;
+  }
+
+  rd->mapSize = (size_t) st.st_size;
+  rd->map = mmap(NULL, rd->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (rd->map == MAP_FAILED) {
+    perror(path);
+    rd->map = NULL;
+    return -1;
+  }
+  madvise((void *) rd->map, rd->mapSize, MADV_SEQUENTIAL);
+
+  rd->header = (const CapHeader *) rd->map;
+  if (memcmp(rd->header->magic, CAP_MAGIC, sizeof(CAP_MAGIC)) != 0
+      || rd->header->version != CAP_VERSION
+      || rd->header->recordSize != sizeof(CapRecord)
+      || rd->header->blockRecords != CAP_BLOCK_RECORDS) {
+    fprintf(stderr, "%s: unsupported capture format\n", path);
+    CapCloseRead(rd);
+    return -1;
+  }
+
+  rd->blocks = (rd->mapSize - CAP_HEADER_SIZE) / CAP_BLOCK_SIZE;
+  while (rd->blocks > 0 && !blockValid(rd->map, rd->blocks-1)) {
+    rd->blocks--;
+  }
+  return 0;
+}
+
+/**
+CapCloseRead()
+
+Unmaps a capture opened with CapOpenRead().
+*/
+void CapCloseRead ( CapReader *rd )
+{
+  if (rd->map) {
+    munmap((void *) rd->map, rd->mapSize);
+  }
+  memset(rd, 0, sizeof(*rd));
+}
+
+/**
+CapBlockFooter()
+
+@return Footer of block 'block'. The block must be below rd->blocks.
+*/
+const CapFooter *CapBlockFooter ( const CapReader *rd, size_t block )
+{
+  return (const CapFooter *) (rd->map + CAP_HEADER_SIZE + block*CAP_BLOCK_SIZE
+                              + CAP_BLOCK_RECORDS*sizeof(CapRecord));
+}
+
+/**
+CapBlock()
+
+Zero-copy access to the records of one block.
+
+@param  rd is an open reader.
+@param  block is the block index, below rd->blocks.
+@param  count receives the number of valid records in the block.
+@return Pointer into the mapping.
+*/
+const CapRecord *CapBlock ( const CapReader *rd, size_t block, uint32_t *count )
+{
+  *count = CapBlockFooter(rd, block)->count;
+  return (const CapRecord *) (rd->map + CAP_HEADER_SIZE + block*CAP_BLOCK_SIZE);
+}
+
+/**
+CapSeek()
+
+Finds the first record with t_us >= 't_us'.
+Binary search over the block footers, then over the records of the chosen block,
+so the cost is O(log n) and only touches a handful of pages.
+
+@param  rd is an open reader.
+@param  t_us is the time to seek to.
+@param  index receives the record index within the returned block.
+@return Block index, or rd->blocks if every record is older than 't_us'.
+*/
+size_t CapSeek ( const CapReader *rd, int64_t t_us, uint32_t *index )
+{
+  size_t lo = 0, hi = rd->blocks, mid;
+  const CapRecord *r;
+  uint32_t n, a, b, m;
+
+  // First block whose last record is not older than t_us
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (CapBlockFooter(rd, mid)->tLast < t_us) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *index = 0;
+  if (lo == rd->blocks) {
+    return lo;
+  }
+
+  r = CapBlock(rd, lo, &n);
+  a = 0;
+  b = n;
+  while (a < b) {
+    m = a + (b - a) / 2;
+    if (r[m].t_us < t_us) {
+      a = m + 1;
+    } else {
+      b = m;
+    }
+  }
+  *index = a;
+  return lo;
+}
+
+/**
+writeBlock()
+
+Appends the buffered records as one complete block, then starts a new block.
+A partially filled block is zero padded so every block keeps the same size.
+*/
+static int writeBlock ( CapWriter *w )
+{
+  unsigned char buf[CAP_BLOCK_SIZE];
+  CapFooter *f = (CapFooter *) (buf + CAP_BLOCK_RECORDS*sizeof(CapRecord));
+  size_t done = 0;
+  ssize_t n;
+
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, w->records, w->count*sizeof(CapRecord));
+  f->magic  = CAP_FOOTER_MAGIC;
+  f->count  = w->count;
+  f->tFirst = w->records[0].t_us;
+  f->tLast  = w->records[w->count-1].t_us;
+  f->block  = w->block;
+  f->crc    = footerCrc((const CapRecord *) buf, f);
+
+  while (done < sizeof(buf)) {
+    if ((n = write(w->fd, buf + done, sizeof(buf) - done)) < 0) {
+      perror("capture write");
+      return -1;
+    }
+    done += (size_t) n;
+  }
+
+  w->block++;
+  w->count = 0;
+  return 0;
+}
+
+/**
+CapOpenWrite()
+
+Opens a capture for appending, creating it if needed.
+An existing file is validated first and cut back to its last intact block, so a
+capture interrupted by a crash can simply be reopened and continued. w->tLast and
+w->total then describe what the file already holds, so the caller can continue its
+time base and sequence numbers.
+
+@param  w is the writer to initialize.
+@param  path is the capture file.
+@param  epochUnixUs is recorded in the header of a new file.
+@return 0 on success, -1 on error (message printed to stderr).
+*/
+int CapOpenWrite ( CapWriter *w, const char *path, int64_t epochUnixUs )
+{
+  CapHeader h;
+  CapReader rd;
+  struct stat st;
+  size_t b;
+
+  memset(w, 0, sizeof(*w));
+  w->tLast = INT64_MIN;
+
+  if (stat(path, &st) == 0 && st.st_size > 0) {
+    if (CapOpenRead(&rd, path) < 0) {
+      return -1;
+    }
+    w->block = (uint32_t) rd.blocks;
+    if (rd.blocks > 0) {
+      w->tLast = CapBlockFooter(&rd, rd.blocks-1)->tLast;
+    }
+    for (b = 0; b < rd.blocks; b++) {
+      w->total += CapBlockFooter(&rd, b)->count;
+    }
+    CapCloseRead(&rd);
+
+    if ((w->fd = open(path, O_WRONLY | O_APPEND)) < 0
+        || ftruncate(w->fd, CAP_HEADER_SIZE + (off_t) w->block*CAP_BLOCK_SIZE) < 0) {
+      perror(path);
+      return -1;
+    }
+    return 0;
+  }
+
+  if ((w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+    perror(path);
+    return -1;
+  }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CAP_MAGIC, sizeof(CAP_MAGIC));
+  h.version      = CAP_VERSION;
+  h.recordSize   = sizeof(CapRecord);
+  h.blockRecords = CAP_BLOCK_RECORDS;
+  h.epochUnixUs  = epochUnixUs;
+
+  if (write(w->fd, &h, sizeof(h)) != sizeof(h) || fsync(w->fd) < 0) {
+    perror(path);
+    close(w->fd);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+CapAppend()
+
+Buffers one record; a full block is written out immediately.
+
+@return 0 on success, -1 if the write failed or 'r' is older than the previous record.
+*/
+int CapAppend ( CapWriter *w, const CapRecord *r )
+{
+  if (r->t_us < w->tLast) {
+    fprintf(stderr, "capture: record out of time order\n");
+    return -1;
+  }
+  w->records[w->count++] = *r;
+  w->tLast = r->t_us;
+  w->total++;
+  if (w->count == CAP_BLOCK_RECORDS) {
+    return writeBlock(w);
+  }
+  return 0;
+}
+
+/**
+CapFlush()
+
+Writes any buffered records as a (short) block and syncs the file.
+Each flush costs a full block on disk, so call it on shutdown or at long intervals.
+*/
+int CapFlush ( CapWriter *w )
+{
+  if (w->count > 0 && writeBlock(w) < 0) {
+    return -1;
+  }
+  return fdatasync(w->fd);
+}
+
+/**
+CapClose()
+
+Flushes and closes a writer.
+*/
+int CapClose ( CapWriter *w )
+{
+  int rc = CapFlush(w);
+
+  if (close(w->fd) < 0) {
+    rc = -1;
+  }
+  w->fd = -1;
+  return rc;
+}
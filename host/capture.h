@@ -0,0 +1,101 @@
+/**
+* @file capture.h
+*
+* @brief Header file for capture.c
+*
+* Binary capture format for received side events.
+*
+* File layout:
+*   CapHeader                               (CAP_HEADER_SIZE bytes)
+*   block 0: CapRecord[CAP_BLOCK_RECORDS]   (unused slots zero-filled)
+*            CapFooter
+*   block 1: ...
+*
+* Every block has the same size, so block k starts at a fixed offset and a reader
+* can binary search the footers' time ranges without scanning any records.
+* A block and its footer are written in one append; a block whose footer is missing
+* or fails its CRC (e.g. power lost mid-write) marks the end of the valid data.
+*
+* @note All fields are stored little-endian, in the host's native layout.
+*/
+
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAP_MAGIC             "SIDCAP1"
+#define CAP_FOOTER_MAGIC      0x4B4C4253UL     // "SBLK"
+#define CAP_VERSION           1
+#define CAP_HEADER_SIZE       64
+#define CAP_BLOCK_RECORDS     256
+
+// CapRecord.flags
+#define CAP_FLAG_UNKNOWN      0x0001            // Byte is not a side character
+#define CAP_FLAG_FRAMING      0x0002            // Receiver reported a framing error
+#define CAP_FLAG_SYNTH_TIME   0x0004            // Timestamp was interpolated, not measured
+#define CAP_FLAG_FUSED        0x0008            // Merged from several receivers
+#define CAP_CONF_SHIFT        8                 // Fused records: confidence 0-255 in the high byte
+#define CAP_CONF(flags)       ((flags) >> CAP_CONF_SHIFT)
+
+// One received character.
+typedef struct {
+  int64_t  t_us;              // Reception time in microseconds since the capture epoch
+  uint32_t seq;               // Frame sequence number within the capture
+  uint8_t  side;              // Side index (P5 bit), LINK_SIDE_NONE if unknown
+  uint8_t  ch;                // Raw received byte
+  uint16_t flags;             // CAP_FLAG_xxx
+} CapRecord;
+
+typedef struct {
+  char     magic[8];          // CAP_MAGIC, NUL terminated
+  uint16_t version;           // CAP_VERSION
+  uint16_t recordSize;        // sizeof(CapRecord)
+  uint16_t blockRecords;      // CAP_BLOCK_RECORDS
+  uint16_t reserved;
+  int64_t  epochUnixUs;       // Wall clock time of t_us == 0, 0 if unknown
+  uint8_t  pad[CAP_HEADER_SIZE-24];
+} CapHeader;
+
+typedef struct {
+  uint32_t magic;             // CAP_FOOTER_MAGIC
+  uint32_t count;             // Valid records in this block
+  int64_t  tFirst;            // t_us of the first record
+  int64_t  tLast;             // t_us of the last record
+  uint32_t block;             // Index of this block in the file
+  uint32_t crc;               // CRC-32 of the records and the footer fields above
+} CapFooter;
+
+#define CAP_BLOCK_SIZE        (CAP_BLOCK_RECORDS*sizeof(CapRecord)+sizeof(CapFooter))
+
+typedef struct {
+  int       fd;
+  uint32_t  block;            // Index of the block being filled
+  uint32_t  count;            // Records buffered in 'records'
+  int64_t   tLast;            // t_us of the last record appended, INT64_MIN if none
+  uint32_t  total;            // Records in the file, those already there included
+  CapRecord records[CAP_BLOCK_RECORDS];
+} CapWriter;
+
+typedef struct {
+  const unsigned char *map;   // Read-only mapping of the whole file
+  size_t               mapSize;
+  size_t               blocks;   // Number of valid blocks
+  const CapHeader     *header;
+} CapReader;
+
+extern int  CapOpenWrite ( CapWriter *w, const char *path, int64_t epochUnixUs );
+extern int  CapAppend ( CapWriter *w, const CapRecord *r );
+extern int  CapFlush ( CapWriter *w );
+extern int  CapClose ( CapWriter *w );
+
+extern int  CapOpenRead ( CapReader *rd, const char *path );
+extern void CapCloseRead ( CapReader *rd );
+extern const CapRecord *CapBlock ( const CapReader *rd, size_t block, uint32_t *count );
+extern const CapFooter *CapBlockFooter ( const CapReader *rd, size_t block );
+extern size_t CapSeek ( const CapReader *rd, int64_t t_us, uint32_t *index );
+
+extern uint32_t CapCrc32 ( uint32_t crc, const void *data, size_t len );
+
+#endif /* __CAPTURE_H */
@@ -0,0 +1,402 @@
+/**
+* @file codebook.c
+*
+* @brief Exhaustive search for side character sets with maximal Hamming distance
+*
+* Usage:
+*   codebook [-n size] [-k keep] [-p ber] [-j threads]
+*     -n size     Number of characters, one per lane (default 6: every face of the cube)
+*     -k keep     Characters that must be in the set, e.g. "xcVM" to keep the current sides
+*     -p ber      Bit error rate used for the misidentification estimate (default 1e-3)
+*     -j threads  Worker threads (default: online CPUs)
+*
+* Candidates are the printable ASCII characters 0x21-0x7E. Space is left out because text
+* logs and captool treat it as a separator. Distance is measured on the
+* whole 10-bit frame; start and stop bits are the same for every character, so it equals
+* the distance between the data bytes.
+*
+* A start-bit slip is a receiver locking on one bit late (the start bit was lost, e.g. a
+* face coming into view mid-frame) or one bit early (a glitch just before the start bit).
+* Late, the UART reads (c >> 1) | 0x80; early, it reads c << 1. The slip distance of a set
+* is the smallest distance from any slipped member to any member, itself included.
+*
+* Sets are ranked by minimum distance, then slip distance, then the sum of all pairwise
+* distances. For each (distance, slip distance) pair, from the best down, every set of the
+* requested size is enumerated. Members are indices into a 128-bit bitset, and a branch's
+* candidates are the intersection of its members' compatibility sets. The first member
+* of a set is distributed over threads.
+*
+* Output is a SIDE_CHARS line for src/config.h (TaskDriver() builds LEDarray from it at
+* startup) and the carrier pin of each lane. The resulting LEDarray, with lanes above the
+* set size copied from the current one, is shown as a comment.
+*
+* Build: cc -O2 -pthread -o codebook codebook.c link.c -lm
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>               // Req'd because we call getopt() and sysconf()
+#include <pthread.h>              // Req'd because we call pthread_create()
+
+#include "link.h"                 // Req'd because we use linkLEDarray[] and linkCarrierPins[]
+
+#define FIRST_CHAR            0x21
+#define LAST_CHAR             0x7E
+#define CANDIDATES            (LAST_CHAR-FIRST_CHAR+1)
+#define MAX_SET               16
+#define MAX_THREADS           256
+#define P5_LANES              8
+
+typedef struct { uint64_t w[2]; } Bits;
+
+typedef struct {
+  unsigned n;                 // Set size
+  unsigned minD, minS;        // Thresholds being searched
+  Bits     adj[CANDIDATES];   // Compatible candidates of each candidate
+  Bits     start;             // Candidates compatible with every kept character
+  unsigned keep[MAX_SET], nKeep;
+  unsigned next;              // Next first member, taken atomically
+  pthread_mutex_t lock;
+  unsigned long long found;   // Sets meeting the thresholds
+  int      bestSum;
+  unsigned best[MAX_SET];
+} Search;
+
+static inline unsigned dist ( unsigned a, unsigned b )
+{
+  return (unsigned) __builtin_popcount((a ^ b) & 0xFF);
+}
+
+/**
+slipDist()
+
+@return Distance from 'a' received one bit late or early to 'b'.
+*/
+static unsigned slipDist ( unsigned a, unsigned b )
+{
+  unsigned late = dist((a >> 1) | 0x80, b), early = dist((a << 1) & 0xFF, b);
+  return late < early ? late : early;
+}
+
+static inline void bitSet ( Bits *b, unsigned i )
+{
+  b->w[i >> 6] |= 1ULL << (i & 63);
+}
+
+static inline int bitTest ( const Bits *b, unsigned i )
+{
+  return (b->w[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline unsigned bitCount ( const Bits *b )
+{
+  return (unsigned) (__builtin_popcountll(b->w[0]) + __builtin_popcountll(b->w[1]));
+}
+
+/**
+setSum()
+
+@return Sum of pairwise distances of the characters in 'set'.
+*/
+static int setSum ( const unsigned *set, unsigned n )
+{
+  unsigned i, j;
+  int sum = 0;
+
+  for (i = 0; i < n; i++) {
+    for (j = i + 1; j < n; j++) {
+      sum += (int) dist(set[i] + FIRST_CHAR, set[j] + FIRST_CHAR);
+    }
+  }
+  return sum;
+}
+
+/**
+record()
+
+Keeps the better of a found set and the best so far.
+*/
+static void record ( Search *s, const unsigned *set )
+{
+  unsigned sorted[MAX_SET], i, j, t;
+  int sum = setSum(set, s->n);
+
+  memcpy(sorted, set, s->n * sizeof(unsigned));
+  for (i = 1; i < s->n; i++) {
+    for (j = i; j > 0 && sorted[j-1] > sorted[j]; j--) {
+      t = sorted[j]; sorted[j] = sorted[j-1]; sorted[j-1] = t;
+    }
+  }
+
+  pthread_mutex_lock(&s->lock);
+  s->found++;
+  if (sum > s->bestSum || (sum == s->bestSum && memcmp(sorted, s->best, s->n * sizeof(unsigned)) < 0)) {
+    s->bestSum = sum;
+    memcpy(s->best, sorted, s->n * sizeof(unsigned));
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/**
+extend()
+
+Depth-first enumeration. 'cand' only holds candidates above the last member added,
+so every set is visited once.
+*/
+static void extend ( Search *s, unsigned *set, unsigned k, Bits cand )
+{
+  Bits next;
+  unsigned j;
+
+  if (k == s->n) {
+    record(s, set);
+    return;
+  }
+  while (bitCount(&cand) >= s->n - k) {
+    j = cand.w[0] ? (unsigned) __builtin_ctzll(cand.w[0]) : 64 + (unsigned) __builtin_ctzll(cand.w[1]);
+    cand.w[j >> 6] &= ~(1ULL << (j & 63));
+
+    set[k] = j;
+    next.w[0] = cand.w[0] & s->adj[j].w[0];
+    next.w[1] = cand.w[1] & s->adj[j].w[1];
+    extend(s, set, k + 1, next);
+  }
+}
+
+/**
+worker()
+
+Thread body: each item fixes the lowest free member of the set.
+*/
+static void *worker ( void *arg )
+{
+  Search *s = arg;
+  unsigned set[MAX_SET], i, first;
+  Bits cand;
+
+  memcpy(set, s->keep, s->nKeep * sizeof(unsigned));
+  if (s->nKeep == s->n) {
+    if (__atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED) == 0) {
+      record(s, set);
+    }
+    return NULL;
+  }
+
+  while ((first = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED)) < CANDIDATES) {
+    if (!bitTest(&s->start, first)) {
+      continue;
+    }
+    // Remaining candidates: above 'first' and compatible with it
+    cand = s->start;
+    for (i = 0; i <= first; i++) {
+      cand.w[i >> 6] &= ~(1ULL << (i & 63));
+    }
+    cand.w[0] &= s->adj[first].w[0];
+    cand.w[1] &= s->adj[first].w[1];
+    set[s->nKeep] = first;
+    extend(s, set, s->nKeep + 1, cand);
+  }
+  return NULL;
+}
+
+/**
+prepare()
+
+Builds the compatibility sets for the current thresholds.
+
+@return 0 if the kept characters are compatible with each other, -1 otherwise.
+*/
+static int prepare ( Search *s )
+{
+  unsigned i, j, k, a, b;
+  int selfOk;
+
+  memset(s->adj, 0, sizeof(s->adj));
+  for (i = 0; i < CANDIDATES; i++) {
+    a = i + FIRST_CHAR;
+    selfOk = slipDist(a, a) >= s->minS;
+    for (j = 0; j < CANDIDATES && selfOk; j++) {
+      b = j + FIRST_CHAR;
+      if (j != i && slipDist(b, b) >= s->minS && dist(a, b) >= s->minD
+          && slipDist(a, b) >= s->minS && slipDist(b, a) >= s->minS) {
+        bitSet(&s->adj[i], j);
+      }
+    }
+  }
+
+  memset(&s->start, 0, sizeof(s->start));
+  for (i = 0; i < CANDIDATES; i++) {
+    for (k = 0; k < s->nKeep && bitTest(&s->adj[s->keep[k]], i); k++);
+    if (k == s->nKeep) {
+      bitSet(&s->start, i);
+    }
+  }
+  for (k = 0; k < s->nKeep; k++) {
+    for (j = k + 1; j < s->nKeep; j++) {
+      if (!bitTest(&s->adj[s->keep[k]], s->keep[j])) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+misidentify()
+
+Probability that a frame from one member is received as another member, averaged over
+the set, with independent bit errors at rate 'p'.
+*/
+static double misidentify ( const unsigned *set, unsigned n, double p )
+{
+  unsigned i, j, d;
+  double sum = 0;
+
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < n; j++) {
+      if (i != j) {
+        d = dist(set[i] + FIRST_CHAR, set[j] + FIRST_CHAR);
+        sum += pow(p, d) * pow(1 - p, LINK_DATA_BITS - d);
+      }
+    }
+  }
+  return sum / n;
+}
+
+/**
+printSideChars()
+
+Prints the set as a SIDE_CHARS line for src/config.h, from which TaskDriver() builds
+LEDarray at startup, with the carrier pin of each lane. The transposed LEDarray follows
+as a comment, for checking against the scope.
+*/
+static void printSideChars ( const unsigned *set, unsigned n )
+{
+  unsigned char frame[LINK_FRAME_BITS];
+  unsigned i, s, c, lanes = n < P5_LANES ? n : P5_LANES;
+
+  for (i = 0; i < LINK_FRAME_BITS; i++) {
+    frame[i] = linkLEDarray[i] & (unsigned char) ~((1u << lanes) - 1);
+  }
+  for (s = 0; s < lanes; s++) {
+    c = set[s] + FIRST_CHAR;
+    for (i = 0; i < LINK_FRAME_BITS; i++) {
+      if ((LinkFrame((unsigned char) c) >> (LINK_FRAME_BITS - 1 - i)) & 1) {
+        frame[i] |= 1u << s;
+      }
+    }
+  }
+
+  for (s = 0; s < lanes; s++) {
+    c = set[s] + FIRST_CHAR;
+    printf("// P5.%u: '%c' 0x%02X, carrier %s\n", s, c, c,
+           s < LINK_SIDES ? linkCarrierPins[s] : "not wired (no spare P2 carrier output)");
+  }
+  if (n > P5_LANES) {
+    printf("// %u characters do not fit the %u P5 lanes; only the first %u are shown.\n",
+           n, P5_LANES, P5_LANES);
+  }
+  if (lanes > LINK_SIDES) {
+    printf("// SIDE_CHARS holds SIDES (%u) characters; raise SIDES in driver.h for the rest.\n",
+           LINK_SIDES);
+  }
+  printf("#define SIDE_CHARS                        {");
+  for (s = 0; s < lanes && s < LINK_SIDES; s++) {
+    c = set[s] + FIRST_CHAR;
+    printf(" '%s%c'%s", c == '\'' || c == '\\' ? "\\" : "", c, s + 1 < lanes && s + 1 < LINK_SIDES ? "," : "");
+  }
+  printf(" }\n");
+
+  printf("// LEDarray built from it, element 0 first:");
+  for (i = 0; i < LINK_FRAME_BITS; i++) {
+    printf(" 0x%02X", frame[i]);
+  }
+  printf("\n");
+}
+
+int main ( int argc, char **argv )
+{
+  static Search s;
+  pthread_t tid[MAX_THREADS];
+  long threads = sysconf(_SC_NPROCESSORS_ONLN), t;
+  const char *keep = "";
+  double ber = 1e-3;
+  unsigned i, j, k;
+  int opt;
+
+  s.n = 6;
+  while ((opt = getopt(argc, argv, "n:k:p:j:")) != -1) {
+    switch (opt) {
+      case 'n': s.n = (unsigned) atoi(optarg); break;
+      case 'k': keep = optarg; break;
+      case 'p': ber = atof(optarg); break;
+      case 'j': threads = atol(optarg); break;
+      default:
+        fprintf(stderr, "usage: codebook [-n size] [-k keep] [-p ber] [-j threads]\n");
+        return 2;
+    }
+  }
+  if (s.n < 2 || s.n > MAX_SET || strlen(keep) > s.n) {
+    fprintf(stderr, "codebook: size must be 2..%d and hold every kept character\n", MAX_SET);
+    return 2;
+  }
+  for (i = 0; keep[i]; i++) {
+    if ((unsigned char) keep[i] < FIRST_CHAR || (unsigned char) keep[i] > LAST_CHAR) {
+      fprintf(stderr, "codebook: '%c' is not printable ASCII\n", keep[i]);
+      return 2;
+    }
+    s.keep[s.nKeep++] = (unsigned char) keep[i] - FIRST_CHAR;
+  }
+  if (threads < 1) {
+    threads = 1;
+  } else if (threads > MAX_THREADS) {
+    threads = MAX_THREADS;
+  }
+  pthread_mutex_init(&s.lock, NULL);
+
+  for (s.minD = LINK_DATA_BITS; s.minD > 0; s.minD--) {
+    for (s.minS = LINK_DATA_BITS; s.minS != (unsigned) -1; s.minS--) {
+      if (prepare(&s) < 0 || bitCount(&s.start) + s.nKeep < s.n) {
+        continue;
+      }
+      s.next = 0;
+      s.found = 0;
+      s.bestSum = -1;
+      for (t = 0; t < threads; t++) {
+        pthread_create(&tid[t], NULL, worker, &s);
+      }
+      for (t = 0; t < threads; t++) {
+        pthread_join(tid[t], NULL);
+      }
+      if (s.found) {
+        goto done;
+      }
+    }
+  }
+  fprintf(stderr, "codebook: no set of %u characters exists\n", s.n);
+  return 1;
+
+done:
+  printf("// Codebook of %u: minimum distance %u, slip distance %u, distance sum %d (%llu sets tie on distances)\n",
+         s.n, s.minD, s.minS, s.bestSum, s.found);
+  printf("// Misidentification per frame at BER %g: %.3e\n", ber, misidentify(s.best, s.n, ber));
+  printf("// Pairwise distances:");
+  for (i = 0; i < s.n; i++) {
+    for (j = i + 1; j < s.n; j++) {
+      printf(" %c%c=%u", s.best[i] + FIRST_CHAR, s.best[j] + FIRST_CHAR,
+             dist(s.best[i] + FIRST_CHAR, s.best[j] + FIRST_CHAR));
+    }
+  }
+  printf("\n");
+
+  // Kept characters stay on their original lanes
+  for (k = 0; k < s.nKeep; k++) {
+    for (i = 0; i < s.n && s.best[i] != s.keep[k]; i++);
+    j = s.best[k]; s.best[k] = s.best[i]; s.best[i] = j;
+  }
+  printSideChars(s.best, s.n);
+  return 0;
+}
@@ -0,0 +1,314 @@
+/**
+* @file craft.c
+*
+* @brief Spacecraft character-set registry and per-craft side decoding
+*
+* Each craft is known by the four characters its sides transmit (SIDE_CHARS in the
+* firmware's config.h). The registry folds all of them into a 256-entry table, so
+* attributing a received byte to a craft and side is a single lookup. Decoder state is
+* a fixed array indexed by craft; decoding allocates nothing.
+*
+* Registry files hold one craft per line:
+*          # name       characters or firmware source
+*          LMRST-Sat    xcVM
+*          LMRST-2      ../unit2/src/config.h
+* A source file is searched for SIDE_CHARS { 'a', 'b', 'c', 'd' } first, then for a
+* LEDarray definition, whose lanes are transposed back into characters.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "craft.h"                // Good to self-reference
+
+#define SOURCE_BUFFER_SIZE    65536
+
+/**
+CraftRegistryInit()
+
+Empties a registry.
+*/
+void CraftRegistryInit ( CraftRegistry *reg )
+{
+  memset(reg, 0, sizeof(*reg));
+  memset(reg->lut, CRAFT_NONE, sizeof(reg->lut));
+}
+
+/**
+CraftAdd()
+
+Registers a craft. A character already used by another craft is marked ambiguous,
+and neither craft is credited with it.
+
+@return Registry index, or -1 if the registry is full or the set repeats a character.
+*/
+int CraftAdd ( CraftRegistry *reg, const char *name, const unsigned char *chars )
+{
+  unsigned s, k, idx = reg->count;
+  CraftKey *key;
+
+  if (idx >= CRAFT_MAX) {
+    fprintf(stderr, "craft: registry full (%d crafts)\n", CRAFT_MAX);
+    return -1;
+  }
+  for (s = 0; s < LINK_SIDES; s++) {
+    for (k = s + 1; k < LINK_SIDES; k++) {
+      if (chars[s] == chars[k]) {
+        fprintf(stderr, "craft: %s uses '%c' on two sides\n", name, chars[s]);
+        return -1;
+      }
+    }
+  }
+
+  snprintf(reg->craft[idx].name, CRAFT_NAME_SIZE, "%s", name);
+  memcpy(reg->craft[idx].chars, chars, LINK_SIDES);
+  for (s = 0; s < LINK_SIDES; s++) {
+    key = &reg->lut[chars[s]];
+    if (key->craft == CRAFT_NONE) {
+      key->craft = (uint8_t) idx;
+      key->side  = (uint8_t) s;
+    } else {
+      fprintf(stderr, "craft: '%c' of %s is also used by %s; ignored for both\n", chars[s], name,
+              key->craft == CRAFT_AMBIGUOUS ? "another craft" : reg->craft[key->craft].name);
+      key->craft = CRAFT_AMBIGUOUS;
+      key->side  = LINK_SIDE_NONE;
+    }
+  }
+  reg->count++;
+  return (int) idx;
+}
+
+/**
+parseSideChars()
+
+Parses the quoted characters following SIDE_CHARS.
+*/
+static int parseSideChars ( const char *p, unsigned char *chars )
+{
+  unsigned s = 0;
+
+  if ((p = strchr(p, '{')) == NULL) {
+    return -1;
+  }
+  while (*p && *p != '}' && s < LINK_SIDES) {
+    if (*p == '\'' && p[1] && p[2] == '\'') {
+      chars[s++] = (unsigned char) p[1];
+      p += 3;
+    } else {
+      p++;
+    }
+  }
+  return s == LINK_SIDES ? 0 : -1;
+}
+
+/**
+parseLEDarray()
+
+Parses a LEDarray initializer and transposes its lanes back into characters.
+Element LINK_FRAME_BITS-1 holds the start bits, element 0 the stop bits.
+*/
+static int parseLEDarray ( const char *p, unsigned char *chars )
+{
+  unsigned char frame[LINK_FRAME_BITS];
+  unsigned i = 0, s, k;
+  char *end;
+
+  if ((p = strchr(p, '{')) == NULL) {
+    return -1;
+  }
+  for (p++; i < LINK_FRAME_BITS; p = end) {
+    while (*p && !isdigit((unsigned char) *p) && *p != '}') {
+      // Skip comments between values
+      if (p[0] == '/' && p[1] == '/') {
+        p = strchr(p, '\n');
+        if (p == NULL) {
+          return -1;
+        }
+      } else {
+        p++;
+      }
+    }
+    if (!isdigit((unsigned char) *p)) {
+      return -1;
+    }
+    frame[i++] = (unsigned char) strtoul(p, &end, 0);
+  }
+
+  for (s = 0; s < LINK_SIDES; s++) {
+    if ((frame[LINK_FRAME_BITS-1] >> s) & 1 || !((frame[0] >> s) & 1)) {
+      return -1;                                // Not a start/stop framed lane
+    }
+    chars[s] = 0;
+    for (k = 0; k < LINK_DATA_BITS; k++) {
+      chars[s] |= ((frame[LINK_FRAME_BITS-1-LINK_START_BITS-k] >> s) & 1) << k;
+    }
+  }
+  return 0;
+}
+
+/**
+CraftCharsFromSource()
+
+Reads a craft's characters from its firmware source (config.h or driver.c).
+
+@return 0 on success, -1 if no definition was found.
+*/
+int CraftCharsFromSource ( const char *path, unsigned char *chars )
+{
+  static char buf[SOURCE_BUFFER_SIZE];
+  const char *p;
+  size_t n;
+  FILE *f;
+  int rc = -1;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    perror(path);
+    return -1;
+  }
+  n = fread(buf, 1, sizeof(buf) - 1, f);
+  buf[n] = '\0';
+  fclose(f);
+
+  if ((p = strstr(buf, "#define SIDE_CHARS")) != NULL) {
+    rc = parseSideChars(p, chars);
+  } else if ((p = strstr(buf, "LEDarray[")) != NULL) {
+    rc = parseLEDarray(p, chars);
+  }
+  if (rc < 0) {
+    fprintf(stderr, "%s: no SIDE_CHARS or LEDarray definition found\n", path);
+  }
+  return rc;
+}
+
+/**
+CraftCharsFromSpec()
+
+Reads a craft's characters as given in a registry line or a tool's -S option: the four
+characters themselves, or the path of the firmware source defining them.
+
+@return 0 on success, -1 if the source holds no definition.
+*/
+int CraftCharsFromSpec ( const char *spec, unsigned char *chars )
+{
+  if (strlen(spec) == LINK_SIDES && strchr(spec, '/') == NULL && strchr(spec, '.') == NULL) {
+    memcpy(chars, spec, LINK_SIDES);
+    return 0;
+  }
+  return CraftCharsFromSource(spec, chars);
+}
+
+/**
+CraftRegistryLoad()
+
+Adds every craft listed in a registry file.
+
+@return Number of crafts added, or -1 on error.
+*/
+int CraftRegistryLoad ( CraftRegistry *reg, const char *path )
+{
+  char line[512], name[CRAFT_NAME_SIZE], spec[400];
+  unsigned char chars[LINK_SIDES];
+  unsigned lineNo = 0;
+  int added = 0;
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    perror(path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    lineNo++;
+    if (sscanf(line, " %31s %399s", name, spec) != 2 || name[0] == '#') {
+      continue;
+    }
+    if (CraftCharsFromSpec(spec, chars) < 0) {
+      fprintf(stderr, "%s:%u: skipping %s\n", path, lineNo, name);
+      continue;
+    }
+    if (CraftAdd(reg, name, chars) >= 0) {
+      added++;
+    }
+  }
+  fclose(f);
+  return added;
+}
+
+/**
+CraftDecoderInit()
+*/
+void CraftDecoderInit ( CraftDecoder *d, const CraftRegistry *reg )
+{
+  unsigned i;
+
+  memset(d, 0, sizeof(*d));
+  d->reg = reg;
+  for (i = 0; i < CRAFT_MAX; i++) {
+    d->st[i].side = LINK_SIDE_NONE;
+  }
+}
+
+/**
+CraftDecode()
+
+Attributes one received byte and advances that craft's state machine:
+  no side -> side seen -> (another side) transition -> ...
+A transition between adjacent sides is a quarter turn. Its direction follows the side
+order, and its interval updates the smoothed spin rate. A face not heard for
+CRAFT_TIMEOUT_US puts the craft back to no side, and the first interval after that
+replaces the spin rate rather than being averaged with the one before the loss.
+
+@param  d is the decoder.
+@param  t_us is the reception time.
+@param  ch is the received byte.
+@param  transition is set to 1 if this byte completed a face transition, else 0.
+@return Craft index, CRAFT_NONE or CRAFT_AMBIGUOUS.
+*/
+unsigned CraftDecode ( CraftDecoder *d, int64_t t_us, unsigned char ch, int *transition )
+{
+  const CraftKey key = d->reg->lut[ch];
+  CraftState *st;
+  unsigned step;
+  int64_t tMid;
+  double quarter, rpm;
+
+  *transition = 0;
+  if (key.craft == CRAFT_NONE) {
+    d->unknown++;
+    return CRAFT_NONE;
+  }
+  if (key.craft == CRAFT_AMBIGUOUS) {
+    d->ambiguous++;
+    return CRAFT_AMBIGUOUS;
+  }
+
+  st = &d->st[key.craft];
+  st->frames++;
+  if (st->side != LINK_SIDE_NONE && t_us - st->tLast > CRAFT_TIMEOUT_US) {
+    st->side = LINK_SIDE_NONE;
+    st->tTransition = 0;
+    st->intervals = 0;                          // Smoothing restarts with the next interval
+  }
+
+  if (st->side != LINK_SIDE_NONE && key.side != st->side) {
+    step = (st->side - key.side + LINK_SIDES) % LINK_SIDES;
+    if (step == 1 || step == LINK_SIDES - 1) {
+      *transition = 1;
+      st->transitions++;
+      // Transition time is taken halfway between the two faces' receptions
+      tMid = (st->tLast + t_us) / 2;
+      if (st->tTransition) {
+        quarter = (double) (tMid - st->tTransition);
+        rpm = 60e6 / (quarter * LINK_SIDES) * (step == 1 ? 1 : -1);
+        st->rpm = st->intervals++ ? 0.5 * (st->rpm + rpm) : rpm;
+      }
+      st->tTransition = tMid;
+    } else {
+      st->tTransition = 0;                      // Skipped a face: cannot time this one
+    }
+  }
+  st->side  = key.side;
+  st->tLast = t_us;
+  return key.craft;
+}
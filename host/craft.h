@@ -0,0 +1,68 @@
+/**
+* @file craft.h
+*
+* @brief Header file for craft.c
+*
+* Registry of spacecraft character sets and the per-craft side decoder.
+*/
+
+#ifndef __CRAFT_H
+#define __CRAFT_H
+
+#include <stdint.h>
+
+#include "link.h"
+
+#define CRAFT_MAX             64
+#define CRAFT_NAME_SIZE       32
+
+// CraftKey.craft values that are not registry indices
+#define CRAFT_NONE            0xFF            // Character belongs to no craft
+#define CRAFT_AMBIGUOUS       0xFE            // Character is used by more than one craft
+
+// A face with no reception for this long is considered lost
+#define CRAFT_TIMEOUT_US      2000000
+
+typedef struct {
+  char          name[CRAFT_NAME_SIZE];
+  unsigned char chars[LINK_SIDES];            // Character of each side, P5.0 first
+} Craft;
+
+typedef struct {
+  uint8_t craft;
+  uint8_t side;
+} CraftKey;
+
+typedef struct {
+  Craft    craft[CRAFT_MAX];
+  unsigned count;
+  CraftKey lut[256];                          // Received byte -> craft and side
+} CraftRegistry;
+
+// Decoding state of one craft
+typedef struct {
+  int64_t  tLast;             // Last reception
+  int64_t  tTransition;       // Last face transition
+  double   rpm;               // Smoothed spin rate, signed: positive is counter-clockwise
+  uint32_t frames;
+  uint32_t transitions;
+  uint32_t intervals;         // Quarter turns timed since the craft was last acquired
+  uint8_t  side;              // Side last seen, LINK_SIDE_NONE if lost
+} CraftState;
+
+typedef struct {
+  const CraftRegistry *reg;
+  CraftState    st[CRAFT_MAX];
+  unsigned long unknown, ambiguous;
+} CraftDecoder;
+
+extern void     CraftRegistryInit ( CraftRegistry *reg );
+extern int      CraftAdd ( CraftRegistry *reg, const char *name, const unsigned char *chars );
+extern int      CraftRegistryLoad ( CraftRegistry *reg, const char *path );
+extern int      CraftCharsFromSource ( const char *path, unsigned char *chars );
+extern int      CraftCharsFromSpec ( const char *spec, unsigned char *chars );
+
+extern void     CraftDecoderInit ( CraftDecoder *d, const CraftRegistry *reg );
+extern unsigned CraftDecode ( CraftDecoder *d, int64_t t_us, unsigned char ch, int *transition );
+
+#endif /* __CRAFT_H */
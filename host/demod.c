@@ -0,0 +1,408 @@
+/**
+* @file demod.c
+*
+* @brief Offline UART demodulator for raw logic-analyser captures of the IR receiver output
+*
+* Usage:
+*   demod [-r rate] [-b baud] [-c mask] [-i] [-S chars] [-o out.cap] <capture.bin>
+*     -r rate   Sample rate in samples/s (default 1000000)
+*     -b baud   Force a baud rate instead of detecting it per channel
+*     -c mask   Channels to decode, one bit per channel (default 0x01)
+*     -i        Inverted line (idle low)
+*     -S chars  Side characters of the beacon: four characters, or its config.h (default xcVM)
+*     -o file   Append decoded frames to a capture file (see capture.h) instead of printing;
+*               an existing capture is continued from its last time and record count
+*
+* The capture is one byte per sample, bit n holding channel n, which is the plain binary
+* export of 8-channel logic analysers. Each channel is decoded on its own thread.
+*
+* Frames are those TaskDriver() emits: 1 start bit, 8 data bits LSB first, 1 stop bit.
+* Each channel's baud rate is detected from the shortest recurring pulse width and snapped
+* to the nearest entry of signal.c's baud[][] table (1200/2400/4800 bps).
+*
+* Idle line is scanned eight samples at a time: one 64-bit word holds eight samples, and
+* the falling edges of all eight are found with a shift, an and-not and a count of trailing
+* zeros. Inside a frame only the bit centres are read, so the cost per frame is a few dozen
+* loads regardless of the oversampling ratio.
+*
+* Build: cc -O2 -pthread -o demod demod.c capture.c craft.c link.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>               // Req'd because we call getopt()
+#include <fcntl.h>                // Req'd because we call open()
+#include <pthread.h>              // Req'd because we call pthread_create()
+#include <sys/mman.h>             // Req'd because we call mmap()
+#include <sys/stat.h>             // Req'd because we call fstat()
+#include <time.h>                 // Req'd because we call clock_gettime()
+
+#include "capture.h"              // Req'd because we call CapAppend()
+#include "craft.h"                // Req'd because we call CraftCharsFromSpec()
+#include "link.h"                 // Req'd because we use linkBaud[] and LinkSideOf()
+
+#define CHANNELS              8
+#define DETECT_SAMPLES        (1u << 24)      // Samples examined for baud detection
+#define DETECT_MIN_PULSES     8               // Pulses needed before a width is trusted
+#define BAUD_TOLERANCE        0.15            // Accepted relative error when snapping
+
+// Decoded frame flags, same meaning as in capture.h
+#define FRAME_FRAMING         CAP_FLAG_FRAMING
+#define FRAME_GLITCH          0x0100          // Bit-centre votes disagreed
+
+typedef struct {
+  uint64_t sample;            // Sample index of the start-bit edge
+  uint8_t  ch;
+  uint8_t  channel;
+  uint16_t flags;
+} Frame;
+
+typedef struct {
+  const uint8_t *s;           // Mapped capture
+  size_t   n;                 // Number of samples
+  double   rate;
+  unsigned baud;              // 0 to detect
+  unsigned channel;
+  uint8_t  invert;            // 0x00 or 0xFF
+  Frame   *frames;            // Output, owned by the thread
+  size_t   count;
+  size_t   glitches;
+} Channel;
+
+/**
+broadcast()
+
+@return 'b' repeated in all eight bytes of a word.
+*/
+static inline uint64_t broadcast ( uint8_t b )
+{
+  return 0x0101010101010101ULL * b;
+}
+
+/**
+findFall()
+
+Finds the next falling edge (1 -> 0) on the channel(s) in 'mask'.
+Eight samples are tested per word; the scalar tail handles the last few.
+
+@param  s is the sample array, 'inv' is XORed into every sample first.
+@param  i is the first sample that may hold the edge, at least 1.
+@param  n is the number of samples.
+@return Index of the first low sample after a high one, or n if there is none.
+*/
+static size_t findFall ( const uint8_t *s, size_t i, size_t n, uint8_t mask, uint8_t inv )
+{
+  const uint64_t m = broadcast(mask), x = broadcast(inv);
+  uint64_t w, p, fall;
+
+  for (; i + 8 <= n; i += 8) {
+    memcpy(&w, s + i, 8);
+    w ^= x;
+    p = (w << 8) | ((uint64_t) (s[i-1] ^ inv));
+    fall = p & ~w & m;
+    if (fall) {
+      return i + (size_t) (__builtin_ctzll(fall) >> 3);
+    }
+  }
+  for (; i < n; i++) {
+    if (((s[i-1] ^ inv) & mask) && !((s[i] ^ inv) & mask)) {
+      return i;
+    }
+  }
+  return n;
+}
+
+/**
+detectBaud()
+
+Estimates a channel's baud rate from the narrowest pulse that recurs at least
+DETECT_MIN_PULSES times, then snaps it to the transmitter's baud table.
+
+@return Baud rate, or 0 if no table entry is within BAUD_TOLERANCE.
+*/
+static unsigned detectBaud ( const Channel *c )
+{
+  const uint8_t mask = (uint8_t) (1u << c->channel);
+  size_t n = c->n < DETECT_SAMPLES ? c->n : DETECT_SAMPLES;
+  size_t i, run = 0, best = 0;
+  unsigned *hist;
+  unsigned k, level, prev;
+  double est, err, bestErr = BAUD_TOLERANCE;
+  unsigned baud = 0;
+
+  // Histogram of run lengths up to one 1200 bps bit plus margin
+  size_t maxRun = (size_t) (c->rate / linkBaud[0] * 2) + 1;
+  if ((hist = calloc(maxRun + 1, sizeof(*hist))) == NULL) {
+    return 0;
+  }
+
+  prev = (c->s[0] ^ c->invert) & mask;
+  for (i = 1; i < n; i++) {
+    level = (c->s[i] ^ c->invert) & mask;
+    run++;
+    if (level != prev) {
+      if (run <= maxRun) {
+        hist[run]++;
+      }
+      run = 0;
+      prev = level;
+    }
+  }
+
+  // Narrowest recurring run. Runs span whole bits, so ignore glitches below 1/4 of the
+  // fastest bit.
+  for (i = (size_t) (c->rate / linkBaud[LINK_BAUD_RATES-1] / 4); i <= maxRun; i++) {
+    if (hist[i] >= DETECT_MIN_PULSES) {
+      // Average the cluster around the first peak
+      size_t sum = 0, cnt = 0, j;
+      for (j = i; j <= maxRun && j <= i + i / 4 + 1; j++) {
+        sum += j * hist[j];
+        cnt += hist[j];
+      }
+      best = sum / cnt;
+      break;
+    }
+  }
+  free(hist);
+  if (best == 0) {
+    return 0;
+  }
+
+  est = c->rate / (double) best;
+  for (k = 0; k < LINK_BAUD_RATES; k++) {
+    err = est > linkBaud[k] ? est / linkBaud[k] - 1 : linkBaud[k] / est - 1;
+    if (err < bestErr) {
+      bestErr = err;
+      baud = linkBaud[k];
+    }
+  }
+  return baud;
+}
+
+/**
+vote()
+
+Majority of three samples around a bit centre.
+Sets *glitch when the three disagree.
+*/
+static inline unsigned vote ( const Channel *c, size_t centre, size_t d, uint8_t mask, int *glitch )
+{
+  unsigned a = (c->s[centre - d] ^ c->invert) & mask;
+  unsigned b = (c->s[centre]     ^ c->invert) & mask;
+  unsigned e = (c->s[centre + d] ^ c->invert) & mask;
+
+  if (a != b || b != e) {
+    *glitch = 1;
+  }
+  return (a && b) || (a && e) || (b && e);
+}
+
+/**
+decodeChannel()
+
+Thread body: decodes every frame on one channel.
+*/
+static void *decodeChannel ( void *arg )
+{
+  Channel *c = arg;
+  const uint8_t mask = (uint8_t) (1u << c->channel);
+  size_t cap = 1024, i = 1, edge, d;
+  double spb;
+  unsigned k, ch;
+  int glitch;
+  Frame *f;
+
+  if (c->baud == 0 && (c->baud = detectBaud(c)) == 0) {
+    fprintf(stderr, "channel %u: no baud rate in the table matches\n", c->channel);
+    return NULL;
+  }
+  spb = c->rate / c->baud;
+  d = (size_t) (spb / 8);                       // Vote spread: +-1/8 bit
+  if ((c->frames = malloc(cap * sizeof(Frame))) == NULL) {
+    return NULL;
+  }
+
+  while ((edge = findFall(c->s, i, c->n, mask, c->invert)) < c->n) {
+    // Whole frame must be inside the capture
+    if (edge + (size_t) (spb * LINK_FRAME_BITS) + d + 1 >= c->n) {
+      break;
+    }
+
+    glitch = 0;
+    if (vote(c, edge + (size_t) (spb / 2), d, mask, &glitch)) {
+      // Start bit did not hold: a spike, not a frame
+      i = edge + 1;
+      c->glitches++;
+      continue;
+    }
+
+    ch = 0;
+    for (k = 0; k < LINK_DATA_BITS; k++) {
+      ch |= vote(c, edge + (size_t) (spb * (LINK_START_BITS + k + 0.5)), d, mask, &glitch) << k;
+    }
+
+    if (c->count == cap) {
+      cap *= 2;
+      if ((f = realloc(c->frames, cap * sizeof(Frame))) == NULL) {
+        return NULL;
+      }
+      c->frames = f;
+    }
+    f = &c->frames[c->count++];
+    f->sample  = edge;
+    f->ch      = (uint8_t) ch;
+    f->channel = (uint8_t) c->channel;
+    f->flags   = glitch ? FRAME_GLITCH : 0;
+    if (!vote(c, edge + (size_t) (spb * (LINK_FRAME_BITS - 0.5)), d, mask, &glitch)) {
+      f->flags |= FRAME_FRAMING;
+    }
+    c->glitches += glitch;
+
+    // Resume from the middle of the stop bit
+    i = edge + (size_t) (spb * (LINK_FRAME_BITS - 0.5));
+  }
+  return NULL;
+}
+
+int main ( int argc, char **argv )
+{
+  Channel ch[CHANNELS];
+  pthread_t tid[CHANNELS];
+  unsigned mask = 0x01, baud = 0, k, best;
+  size_t pos[CHANNELS], total = 0, glitches = 0, framing = 0;
+  double rate = 1e6, secs;
+  uint8_t invert = 0;
+  const char *outPath = NULL;
+  struct timespec t0, t1;
+  struct stat st;
+  const uint8_t *s;
+  CapWriter w;
+  CapRecord r;
+  Frame *f;
+  int64_t tBase = 0;
+  uint32_t seq = 0;
+  unsigned char chars[LINK_SIDES];
+  int opt, fd;
+
+  while ((opt = getopt(argc, argv, "r:b:c:iS:o:")) != -1) {
+    switch (opt) {
+      case 'r': rate = atof(optarg); break;
+      case 'b': baud = (unsigned) atoi(optarg); break;
+      case 'c': mask = (unsigned) strtoul(optarg, NULL, 0) & 0xFF; break;
+      case 'i': invert = 0xFF; break;
+      case 'S':
+        if (CraftCharsFromSpec(optarg, chars) < 0) {
+          return 2;
+        }
+        LinkSetSideChars(chars);
+        break;
+      case 'o': outPath = optarg; break;
+      default:
+        fprintf(stderr, "usage: demod [-r rate] [-b baud] [-c mask] [-i] [-S chars] [-o out.cap] <capture.bin>\n");
+        return 2;
+    }
+  }
+  if (optind != argc - 1 || rate <= 0) {
+    fprintf(stderr, "usage: demod [-r rate] [-b baud] [-c mask] [-i] [-S chars] [-o out.cap] <capture.bin>\n");
+    return 2;
+  }
+
+  if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (st.st_size < 2) {
+    fprintf(stderr, "%s: capture too short\n", argv[optind]);
+    return 1;
+  }
+  s = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (s == MAP_FAILED) {
+    perror(argv[optind]);
+    return 1;
+  }
+  madvise((void *) s, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  memset(ch, 0, sizeof(ch));
+  for (k = 0; k < CHANNELS; k++) {
+    if (mask & (1u << k)) {
+      ch[k].s       = s;
+      ch[k].n       = (size_t) st.st_size;
+      ch[k].rate    = rate;
+      ch[k].baud    = baud;
+      ch[k].channel = k;
+      ch[k].invert  = invert;
+      pthread_create(&tid[k], NULL, decodeChannel, &ch[k]);
+    }
+  }
+  for (k = 0; k < CHANNELS; k++) {
+    if (mask & (1u << k)) {
+      pthread_join(tid[k], NULL);
+      if (ch[k].baud) {
+        fprintf(stderr, "channel %u: %u bps, %zu frames\n", k, ch[k].baud, ch[k].count);
+      }
+      total    += ch[k].count;
+      glitches += ch[k].glitches;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if (outPath) {
+    if (CapOpenWrite(&w, outPath, 0) < 0) {
+      return 1;
+    }
+    // An appended capture starts where the file ends, its seq after the file's records
+    if (w.tLast != INT64_MIN) {
+      tBase = w.tLast;
+    }
+    seq = w.total;
+  }
+
+  // Merge the per-channel lists in time order
+  memset(pos, 0, sizeof(pos));
+  for (;;) {
+    best = CHANNELS;
+    for (k = 0; k < CHANNELS; k++) {
+      if (pos[k] < ch[k].count
+          && (best == CHANNELS || ch[k].frames[pos[k]].sample < ch[best].frames[pos[best]].sample)) {
+        best = k;
+      }
+    }
+    if (best == CHANNELS) {
+      break;
+    }
+    f = &ch[best].frames[pos[best]++];
+    framing += (f->flags & FRAME_FRAMING) != 0;
+
+    if (outPath) {
+      r.t_us  = tBase + (int64_t) (f->sample / rate * 1e6);
+      r.seq   = seq++;                            // One count over all channels, in time order
+      r.ch    = f->ch;
+      r.side  = (uint8_t) LinkSideOf(f->ch);
+      r.flags = (uint16_t) ((f->flags & FRAME_FRAMING) | (r.side == LINK_SIDE_NONE ? CAP_FLAG_UNKNOWN : 0));
+      if (CapAppend(&w, &r) < 0) {
+        return 1;
+      }
+    } else {
+      printf("%.6f ch%u 0x%02x %c%s%s\n", f->sample / rate, f->channel, f->ch,
+             f->ch >= 0x20 && f->ch < 0x7F ? f->ch : '.',
+             f->flags & FRAME_FRAMING ? " FE" : "", f->flags & FRAME_GLITCH ? " GL" : "");
+    }
+  }
+  if (outPath && CapClose(&w) < 0) {
+    return 1;
+  }
+
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  fprintf(stderr, "%zu frames, %zu framing errors, %zu glitches; %.1f Msamples/s, %.0fx real time\n",
+          total, framing, glitches, st.st_size / secs / 1e6, st.st_size / rate / secs);
+
+  for (k = 0; k < CHANNELS; k++) {
+    free(ch[k].frames);
+  }
+  munmap((void *) s, (size_t) st.st_size);
+  return 0;
+}
@@ -0,0 +1,495 @@
+/**
+* @file fusion.c
+*
+* @brief Merges several IR receiver streams into one deduplicated side-event stream
+*
+* Usage:
+*   fusion [-b baud] [-g ticks] [-W ms] [-s ms] [-S chars] [-o out.cap] input[,offset_ms[,latency_ms]] ...
+*     -b baud     Receiver baud rate, 1200, 2400 or 4800 (default 2400)
+*     -g ticks    Beacon inter-frame gap, "gap N" on the console (default 1)
+*     -W ms       Window within which receptions of one frame are merged (default 3)
+*     -s ms       Slack allowed for late bytes before a live input's time is final (default 50)
+*     -S chars    Side characters of the beacon: four characters, or its config.h (default xcVM)
+*     -o file     Write fused events to a capture file instead of printing them
+*
+*   Each input is a serial device, a pty or FIFO standing in for one, or a capture file
+*   (*.cap) replayed with its recorded times. 'offset_ms' is the receiver's clock offset and
+*   'latency_ms' its fixed USB latency; both are subtracted from its timestamps.
+*
+* All inputs are merged on one clock, microseconds since fusion started. Live inputs are
+* timed on it directly. A capture whose header records its wall clock epoch is placed on it
+* through that epoch; one that does not is taken to start with fusion (its t_us == 0 is the
+* program start), so such captures keep their timing relative to each other. An output
+* capture records the wall clock time of the program start as its epoch, unless no input
+* is tied to the wall clock.
+*
+* Every input is read on its own thread, which timestamps the bytes and pushes them into a
+* single-producer single-consumer ring. The merge stage, on the main thread, pops from the
+* rings without locks. It merges them in time order, up to a watermark: the earliest time
+* any live input may still deliver. Events closer together than the window form a cluster.
+* A cluster yields one event per distinct character. Its confidence is the share of the
+* receivers heard in the cluster that agree on that character. Receivers facing different
+* faces each produce their own event.
+*
+* The bytes of each USB batch are dated on the transmitter's frame grid by the latency
+* compensation stage (latcomp.c), which removes the converter's batching jitter. The grid
+* assumes one frame per LinkFramePeriod() of the baud rate and gap given. A beacon in TDMA
+* mode ('t' on the console) leaves its guard ticks and the other sides' slots in between, so
+* live inputs cannot be dated on it: switch TDMA off, or record captures and replay them.
+*
+* Build: cc -O2 -pthread -o fusion fusion.c latcomp.c capture.c craft.c link.c -lm
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>            // Req'd because the rings use atomic indices
+#include <signal.h>               // Req'd because we catch SIGINT
+#include <unistd.h>               // Req'd because we call getopt() and read()
+#include <fcntl.h>                // Req'd because we call open()
+#include <poll.h>                 // Req'd because we call poll()
+#include <termios.h>              // Req'd because we call cfsetspeed()
+#include <pthread.h>              // Req'd because we call pthread_create()
+#include <sched.h>                // Req'd because we call sched_yield()
+#include <time.h>                 // Req'd because we call clock_gettime()
+
+#include "capture.h"              // Req'd because we call CapAppend() and CapBlock()
+#include "craft.h"                // Req'd because we call CraftCharsFromSpec()
+#include "latcomp.h"              // Req'd because we call LatCompBatch()
+#include "link.h"                 // Req'd because we call LinkSideOf() and LinkFramePeriod()
+
+#define MAX_INPUTS            16
+#define RING_SIZE             4096            // Events per input ring, power of two
+#define POLL_MS               20
+#define READ_BUFFER_SIZE      512
+#define MAX_CLUSTER           (MAX_INPUTS*4)
+
+typedef struct {
+  int64_t t_us;
+  uint8_t ch;
+} Event;
+
+typedef struct {
+  const char     *path;
+  int64_t         offset_us, latency_us;
+  int             replay;     // Capture file rather than a live stream
+  int64_t         epoch_us;   // Replay: where the capture's t_us == 0 falls on the merge clock
+  LatComp         lc;         // Live streams: USB batch timing
+  pthread_t       tid;
+
+  // Ring: written by the reader thread only at 'head', read by the merge only at 'tail'
+  Event           ring[RING_SIZE];
+  _Atomic size_t  head, tail;
+  _Atomic int64_t progress;   // No event older than this will be pushed any more
+  _Atomic int     done;
+
+  unsigned long   bytes, late, merged;
+} Input;
+
+static Input inputs[MAX_INPUTS];
+static unsigned nInputs;
+static int64_t framePeriod_us, slack_us;
+static int64_t startUs;                       // The merge clock counts from program start
+static speed_t ttyBaud;
+static atomic_int stop;                       // Set by the signal handler, read by every thread
+
+static void onSignal ( int sig )
+{
+  (void) sig;
+  atomic_store(&stop, 1);
+}
+
+/**
+nowUs()
+
+@return Monotonic time in microseconds since startUs.
+*/
+static int64_t nowUs ( void )
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - startUs;
+}
+
+/**
+push()
+
+Adds an event to an input's ring, waiting while the merge stage catches up.
+*/
+static void push ( Input *in, int64_t t, uint8_t ch )
+{
+  size_t head = atomic_load_explicit(&in->head, memory_order_relaxed);
+
+  while (head - atomic_load_explicit(&in->tail, memory_order_acquire) == RING_SIZE) {
+    if (atomic_load(&stop)) {
+      return;
+    }
+    sched_yield();
+  }
+  in->ring[head & (RING_SIZE-1)].t_us = t;
+  in->ring[head & (RING_SIZE-1)].ch   = ch;
+  atomic_store_explicit(&in->head, head + 1, memory_order_release);
+}
+
+/**
+replayInput()
+
+Reader for a capture file: pushes its records with their recorded times, moved onto the
+merge clock.
+*/
+static void replayInput ( Input *in )
+{
+  CapReader rd;
+  const CapRecord *r;
+  uint32_t i, n;
+  size_t b;
+  int64_t t;
+
+  if (CapOpenRead(&rd, in->path) < 0) {
+    return;
+  }
+  for (b = 0; b < rd.blocks && !atomic_load(&stop); b++) {
+    r = CapBlock(&rd, b, &n);
+    for (i = 0; i < n && !atomic_load(&stop); i++) {
+      t = in->epoch_us + r[i].t_us - in->offset_us - in->latency_us;
+      push(in, t, r[i].ch);
+      atomic_store_explicit(&in->progress, t, memory_order_release);
+      in->bytes++;
+    }
+  }
+  CapCloseRead(&rd);
+}
+
+/**
+liveInput()
+
+Reader for a serial device, pty or FIFO.
+*/
+static void liveInput ( Input *in )
+{
+  unsigned char buf[READ_BUFFER_SIZE];
+  struct termios tio;
+  struct pollfd pfd;
+  int64_t t[READ_BUFFER_SIZE], arrival;
+  ssize_t n, k;
+  int fd;
+
+  if ((fd = open(in->path, O_RDONLY | O_NOCTTY | O_NONBLOCK)) < 0) {
+    perror(in->path);
+    return;
+  }
+  if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetspeed(&tio, ttyBaud);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+
+  LatCompInit(&in->lc, framePeriod_us, LATCOMP_DEFAULT_MAX_LATENCY_US);
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (!atomic_load(&stop)) {
+    if (poll(&pfd, 1, POLL_MS) > 0) {
+      if ((n = read(fd, buf, sizeof(buf))) == 0) {
+        break;                                  // Writer closed the FIFO or pty
+      }
+      arrival = nowUs() - in->offset_us - in->latency_us;
+      LatCompBatch(&in->lc, arrival, n > 0 ? (unsigned) n : 0, t);
+      for (k = 0; k < n; k++) {
+        push(in, t[k], buf[k]);
+      }
+      in->bytes += n > 0 ? (unsigned long) n : 0;
+    }
+    // Nothing older than this can still arrive, give or take the slack
+    atomic_store_explicit(&in->progress,
+                          nowUs() - in->offset_us - in->latency_us - slack_us, memory_order_release);
+  }
+  close(fd);
+}
+
+/**
+reader()
+
+Thread body for one input.
+*/
+static void *reader ( void *arg )
+{
+  Input *in = arg;
+
+  if (in->replay) {
+    replayInput(in);
+  } else {
+    liveInput(in);
+  }
+  atomic_store_explicit(&in->done, 1, memory_order_release);
+  return NULL;
+}
+
+/**
+peek()
+
+@return The oldest unread event of an input, or NULL if its ring is empty.
+*/
+static const Event *peek ( Input *in )
+{
+  size_t tail = atomic_load_explicit(&in->tail, memory_order_relaxed);
+
+  if (tail == atomic_load_explicit(&in->head, memory_order_acquire)) {
+    return NULL;
+  }
+  return &in->ring[tail & (RING_SIZE-1)];
+}
+
+static void pop ( Input *in )
+{
+  atomic_fetch_add_explicit(&in->tail, 1, memory_order_release);
+}
+
+// Events of the cluster being collected
+typedef struct {
+  Event   e[MAX_CLUSTER];
+  uint8_t from[MAX_CLUSTER];
+  unsigned n;
+} Cluster;
+
+/**
+emitCluster()
+
+One fused event per distinct character of the cluster.
+*/
+static void emitCluster ( Cluster *c, CapWriter *w, uint32_t *seq, unsigned long *events, int64_t *last )
+{
+  CapRecord out[MAX_CLUSTER], r;
+  unsigned i, j, agree, heard, nOut = 0;
+  uint32_t rxAll = 0, rxCh;
+  int64_t tSum;
+
+  for (i = 0; i < c->n; i++) {
+    rxAll |= 1u << c->from[i];
+  }
+  heard = (unsigned) __builtin_popcount(rxAll);
+
+  for (i = 0; i < c->n; i++) {
+    // First occurrence of this character only
+    for (j = 0; j < i && c->e[j].ch != c->e[i].ch; j++);
+    if (j < i) {
+      continue;
+    }
+    rxCh = 0;
+    tSum = 0;
+    agree = 0;
+    for (j = i; j < c->n; j++) {
+      if (c->e[j].ch == c->e[i].ch) {
+        rxCh |= 1u << c->from[j];
+        tSum += c->e[j].t_us;
+        agree++;
+        inputs[c->from[j]].merged++;
+      }
+    }
+
+    // Insert in time order; means of different characters need not follow their first byte
+    r.t_us  = tSum / agree;
+    r.ch    = c->e[i].ch;
+    r.side  = (uint8_t) LinkSideOf(r.ch);
+    r.flags = (uint16_t) (CAP_FLAG_FUSED | (r.side == LINK_SIDE_NONE ? CAP_FLAG_UNKNOWN : 0)
+            | ((255u * (unsigned) __builtin_popcount(rxCh) / heard) << CAP_CONF_SHIFT));
+    r.seq   = rxCh;                             // Receiver mask until numbered below
+    for (j = nOut++; j > 0 && out[j-1].t_us > r.t_us; j--) {
+      out[j] = out[j-1];
+    }
+    out[j] = r;
+  }
+
+  for (i = 0; i < nOut; i++) {
+    rxCh = out[i].seq;
+    out[i].seq = (*seq)++;
+    if (w) {
+      CapAppend(w, &out[i]);
+    } else {
+      printf("%.6f %c side=%-2d conf=%.2f rx=0x%x\n", out[i].t_us / 1e6,
+             out[i].ch >= 0x20 && out[i].ch < 0x7F ? out[i].ch : '.',
+             out[i].side == LINK_SIDE_NONE ? -1 : out[i].side, CAP_CONF(out[i].flags) / 255.0, rxCh);
+    }
+  }
+  *events += nOut;
+  *last = c->e[c->n-1].t_us;
+  c->n = 0;
+}
+
+/**
+merge()
+
+Lock-free k-way merge of the input rings up to the watermark, with clustering.
+Runs until every input is finished and drained, or SIGINT.
+*/
+static void merge ( CapWriter *w, int64_t window_us )
+{
+  static Cluster c;
+  const Event *e, *best;
+  unsigned i, from = 0, live;
+  int64_t mark, last = INT64_MIN;
+  uint32_t seq = 0;
+  unsigned long events = 0;
+
+  while (!atomic_load(&stop)) {
+    // Watermark: earliest time a live input may still deliver
+    mark = INT64_MAX;
+    live = 0;
+    for (i = 0; i < nInputs; i++) {
+      if (!atomic_load_explicit(&inputs[i].done, memory_order_acquire)) {
+        live++;
+        if (atomic_load_explicit(&inputs[i].progress, memory_order_acquire) < mark) {
+          mark = atomic_load_explicit(&inputs[i].progress, memory_order_acquire);
+        }
+      }
+    }
+
+    best = NULL;
+    for (i = 0; i < nInputs; i++) {
+      if ((e = peek(&inputs[i])) != NULL && (best == NULL || e->t_us < best->t_us)) {
+        best = e;
+        from = i;
+      }
+    }
+
+    if (best == NULL || best->t_us > mark) {
+      if (best == NULL && live == 0) {
+        break;
+      }
+      // Close a cluster nothing else can join
+      if (c.n && (best == NULL || best->t_us > c.e[0].t_us + window_us) && mark > c.e[0].t_us + window_us) {
+        emitCluster(&c, w, &seq, &events, &last);
+      }
+      usleep(1000);
+      continue;
+    }
+
+    if (best->t_us < last) {
+      inputs[from].late++;                    // Arrived after its time was merged
+      pop(&inputs[from]);
+      continue;
+    }
+    if (c.n && (best->t_us > c.e[0].t_us + window_us || c.n == MAX_CLUSTER)) {
+      emitCluster(&c, w, &seq, &events, &last);
+    }
+    c.e[c.n] = *best;
+    c.from[c.n++] = (uint8_t) from;
+    pop(&inputs[from]);
+  }
+  if (c.n) {
+    emitCluster(&c, w, &seq, &events, &last);
+  }
+
+  fprintf(stderr, "%lu fused events\n", events);
+  for (i = 0; i < nInputs; i++) {
+    fprintf(stderr, "  %s: %lu bytes, %lu merged, %lu late\n",
+            inputs[i].path, inputs[i].bytes, inputs[i].merged, inputs[i].late);
+  }
+}
+
+int main ( int argc, char **argv )
+{
+  unsigned baud = linkBaud[LINK_DEFAULT_BAUD], gap = LINK_GAP_TICKS, i, k;
+  double window = 3, slack = 50, offset, latency;
+  const char *outPath = NULL;
+  char *spec, *comma;
+  size_t len;
+  struct timespec wall;
+  int64_t startUnixUs, epochUs = 0;
+  unsigned char chars[LINK_SIDES];
+  CapReader rd;
+  CapWriter w;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:g:W:s:S:o:")) != -1) {
+    switch (opt) {
+      case 'b': baud = (unsigned) atoi(optarg); break;
+      case 'g': gap = (unsigned) atoi(optarg); break;
+      case 'W': window = atof(optarg); break;
+      case 's': slack = atof(optarg); break;
+      case 'S':
+        if (CraftCharsFromSpec(optarg, chars) < 0) {
+          return 2;
+        }
+        LinkSetSideChars(chars);
+        break;
+      case 'o': outPath = optarg; break;
+      default:  argc = 0; break;
+    }
+  }
+  if (argc <= optind || argc - optind > MAX_INPUTS) {
+    fprintf(stderr, "usage: fusion [-b baud] [-g ticks] [-W ms] [-s ms] [-S chars] [-o out.cap] input[,offset_ms[,latency_ms]] ...\n"
+                    "Live inputs are dated assuming one frame per LinkFramePeriod(baud, gap); TDMA ('t') is not supported.\n");
+    return 2;
+  }
+  for (k = 0; k < LINK_BAUD_RATES && linkBaud[k] != baud; k++);
+  if (k == LINK_BAUD_RATES) {
+    fprintf(stderr, "fusion: -b must be a rate the transmitter sends (1200/2400/4800)\n");
+    return 2;
+  }
+  if (gap < 1 || gap > LINK_GAP_TICKS_MAX) {
+    fprintf(stderr, "fusion: -g must be 1..%u ticks, as \"gap N\" on the console\n", LINK_GAP_TICKS_MAX);
+    return 2;
+  }
+
+  framePeriod_us = (int64_t) (LinkFramePeriod(baud, gap) * 1e6);
+  slack_us = (int64_t) (slack * 1000);
+  ttyBaud = baud == 1200 ? B1200 : baud == 4800 ? B4800 : B2400;
+
+  for (nInputs = 0; optind < argc; optind++, nInputs++) {
+    Input *in = &inputs[nInputs];
+    spec = argv[optind];
+    offset = latency = 0;
+    if ((comma = strchr(spec, ',')) != NULL) {
+      *comma = '\0';
+      sscanf(comma + 1, "%lf,%lf", &offset, &latency);
+    }
+    len = strlen(spec);
+    in->path       = spec;
+    in->offset_us  = (int64_t) (offset * 1000);
+    in->latency_us = (int64_t) (latency * 1000);
+    in->replay     = len > 4 && strcmp(spec + len - 4, ".cap") == 0;
+    atomic_init(&in->head, 0);
+    atomic_init(&in->tail, 0);
+    atomic_init(&in->progress, INT64_MIN);
+    atomic_init(&in->done, 0);
+  }
+
+  // The merge clock: monotonic time since now, which was 'startUnixUs' on the wall clock
+  startUs = nowUs();
+  clock_gettime(CLOCK_REALTIME, &wall);
+  startUnixUs = (int64_t) wall.tv_sec * 1000000 + wall.tv_nsec / 1000;
+  for (i = 0; i < nInputs; i++) {
+    if (!inputs[i].replay) {
+      epochUs = startUnixUs;
+    } else if (CapOpenRead(&rd, inputs[i].path) == 0) {
+      if (rd.header->epochUnixUs != 0) {
+        inputs[i].epoch_us = rd.header->epochUnixUs - startUnixUs;
+        epochUs = startUnixUs;
+      }
+      CapCloseRead(&rd);
+    }
+  }
+
+  if (outPath && CapOpenWrite(&w, outPath, epochUs) < 0) {
+    return 1;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  for (i = 0; i < nInputs; i++) {
+    pthread_create(&inputs[i].tid, NULL, reader, &inputs[i]);
+  }
+  merge(outPath ? &w : NULL, (int64_t) (window * 1000));
+  atomic_store(&stop, 1);
+  for (i = 0; i < nInputs; i++) {
+    pthread_join(inputs[i].tid, NULL);
+  }
+
+  if (outPath && CapClose(&w) < 0) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+/**
+* @file latcomp.c
+*
+* @brief Reconstruction of byte reception times behind a USB-serial converter
+*
+* The converter holds received bytes until its latency timer expires (16 ms on common
+* parts) and then hands them to the host in one batch. The host therefore sees a read()
+* of n bytes at one arrival time that lags the last byte by anything up to the timer,
+* more than a whole frame period at 2400 bps.
+*
+* The transmitter, however, emits frames on a fixed grid: one every LinkFramePeriod(),
+* set by baud[][] and the OS_Delay() in TaskDriver(). Within a run of consecutive frames,
+* byte n was received at base + n * period. Every batch whose last byte is byte n gives
+* arrival - n * period = base + its own delay, so the smallest of these over recent batches
+* is base plus only the converter's shortest delay. Each byte is then dated on the grid
+* from that envelope. Taking the minimum over a sliding window lets base follow the drift
+* between the beacon's crystal and the host clock.
+*
+* A batch arriving later than the grid allows by more than the longest latency means
+* frames were lost in between (e.g. no face in view); the grid skips the fewest frames that
+* explain it. After LATCOMP_RESET_US of silence the grid is learned afresh.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "latcomp.h"              // Good to self-reference
+
+/**
+LatCompInit()
+
+@param  lc is the state to reset.
+@param  period_us is the transmitter's frame period.
+@param  maxLatency_us is the longest delay the converter adds, e.g. its latency timer.
+*/
+void LatCompInit ( LatComp *lc, int64_t period_us, int64_t maxLatency_us )
+{
+  memset(lc, 0, sizeof(*lc));
+  lc->period_us     = period_us;
+  lc->maxLatency_us = maxLatency_us;
+  lc->idx           = -1;
+  lc->tLast         = INT64_MIN;
+}
+
+/**
+LatCompBatch()
+
+Dates the bytes of one batch.
+
+@param  lc is the stream's state.
+@param  arrival_us is the time the batch was read.
+@param  n is the number of bytes in the batch.
+@param  t_us receives the reconstructed reception time of each byte, oldest first.
+        Times handed out never go backwards.
+*/
+void LatCompBatch ( LatComp *lc, int64_t arrival_us, unsigned n, int64_t *t_us )
+{
+  const int64_t P = lc->period_us;
+  int64_t excess, offset, base, t;
+  unsigned k, back;
+
+  if (n == 0) {
+    return;
+  }
+  lc->batches++;
+  lc->bytes += n;
+
+  if (lc->idx >= 0 && arrival_us - lc->arrivalLast > LATCOMP_RESET_US) {
+    lc->idx = -1;
+    lc->resets++;
+  }
+
+  if (lc->idx < 0) {
+    lc->idx = n - 1;
+    lc->batch = 0;
+    lc->winHead = lc->winCount = 0;
+  } else {
+    lc->idx += n;
+    excess = arrival_us - (lc->base + lc->idx * P);
+    if (excess > lc->maxLatency_us) {
+      k = (unsigned) ((excess - lc->maxLatency_us + P - 1) / P);
+      lc->idx += k;
+      lc->skipped += k;
+    }
+  }
+
+  // Sliding window minimum: a monotonic queue of offsets, oldest at winHead
+  offset = arrival_us - lc->idx * P;
+  while (lc->winCount && lc->winBatch[lc->winHead] + LATCOMP_WINDOW <= lc->batch) {
+    lc->winHead = (lc->winHead + 1) & (LATCOMP_WINDOW-1);
+    lc->winCount--;
+  }
+  while (lc->winCount) {
+    back = (lc->winHead + lc->winCount - 1) & (LATCOMP_WINDOW-1);
+    if (lc->winOffset[back] < offset) {
+      break;
+    }
+    lc->winCount--;
+  }
+  back = (lc->winHead + lc->winCount) & (LATCOMP_WINDOW-1);
+  lc->winBatch[back]  = lc->batch;
+  lc->winOffset[back] = offset;
+  lc->winCount++;
+  base = lc->winOffset[lc->winHead];
+
+  if (lc->batch > 0) {
+    t = base - lc->base;
+    t = t < 0 ? -t : t;
+    lc->stepSq += (double) t * t;
+    lc->stepMax = t > lc->stepMax ? t : lc->stepMax;
+    lc->steps++;
+  }
+  lc->base = base;
+  lc->batch++;
+
+  excess = offset - base;
+  lc->excessSum += (double) excess;
+  lc->excessSq  += (double) excess * excess;
+  lc->excessMax  = excess > lc->excessMax ? excess : lc->excessMax;
+
+  for (k = 0; k < n; k++) {
+    t = base + (lc->idx - (int64_t) (n - 1 - k)) * P;
+    if (t <= lc->tLast) {
+      t = lc->tLast + 1;
+      lc->clamped++;
+    }
+    t_us[k] = lc->tLast = t;
+  }
+  lc->arrivalLast = arrival_us;
+}
+
+/**
+LatCompReport()
+
+Prints what the reconstruction removed and the jitter that remains.
+*/
+void LatCompReport ( const LatComp *lc, FILE *f )
+{
+  double b = lc->batches ? (double) lc->batches : 1, s = lc->steps ? (double) lc->steps : 1;
+
+  fprintf(f, "# %lu bytes in %lu batches (%.2f per batch), %lu frames skipped, %lu resets, %lu clamped\n",
+          lc->bytes, lc->batches, lc->bytes / b, lc->skipped, lc->resets, lc->clamped);
+  fprintf(f, "# batching delay removed: mean %.3f ms, rms %.3f ms, max %.3f ms\n",
+          lc->excessSum / b / 1e3, sqrt(lc->excessSq / b) / 1e3, lc->excessMax / 1e3);
+  fprintf(f, "# residual jitter (grid moves): rms %.3f ms, max %.3f ms\n",
+          sqrt(lc->stepSq / s) / 1e3, lc->stepMax / 1e3);
+}
@@ -0,0 +1,54 @@
+/**
+* @file latcomp.h
+*
+* @brief Header file for latcomp.c
+*
+* Reconstructs reception times of bytes delivered in batches by a USB-serial converter.
+*/
+
+#ifndef __LATCOMP_H
+#define __LATCOMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Batches over which the arrival envelope is taken, power of two
+#define LATCOMP_WINDOW        256
+
+// Latency timer of common converters (FTDI default 16 ms) plus one USB frame
+#define LATCOMP_DEFAULT_MAX_LATENCY_US  17000
+
+// Silence after which the frame grid is learned afresh
+#define LATCOMP_RESET_US      500000
+
+typedef struct {
+  // Settings
+  int64_t  period_us;         // Frame period of the transmitter
+  int64_t  maxLatency_us;     // Longest delay a batch can see in the converter
+
+  // Frame grid: byte n of the run was received at base + n * period_us
+  int64_t  idx;               // Index of the last byte received in this run, -1 before the first
+  int64_t  base;
+  int64_t  arrivalLast;
+  int64_t  tLast;             // Last time handed out, INT64_MIN if none
+
+  // Sliding minimum of (arrival - idx * period) over the last LATCOMP_WINDOW batches
+  uint64_t batch;             // Batches seen in this run
+  uint64_t winBatch[LATCOMP_WINDOW];
+  int64_t  winOffset[LATCOMP_WINDOW];
+  unsigned winHead, winCount;
+
+  // Statistics
+  unsigned long batches, bytes, skipped, resets, clamped;
+  double   excessSum, excessSq;         // Arrival delay beyond the envelope: what was removed
+  int64_t  excessMax;
+  double   stepSq;                      // Envelope moves between batches: what remains
+  int64_t  stepMax;
+  unsigned long steps;
+} LatComp;
+
+extern void LatCompInit ( LatComp *lc, int64_t period_us, int64_t maxLatency_us );
+extern void LatCompBatch ( LatComp *lc, int64_t arrival_us, unsigned n, int64_t *t_us );
+extern void LatCompReport ( const LatComp *lc, FILE *f );
+
+#endif /* __LATCOMP_H */
@@ -0,0 +1,495 @@
+/**
+* @file latency.c
+*
+* @brief Traces side-identification frames from emission to published spin rate
+*
+* Usage:
+*   latency -c <console> [-b baud] [-g ticks] [-n frames] [-S chars] [-H hist.csv] [-q] <receiver>
+*     -c dev      Beacon console (TaskUI, 9600 bps); trace reports are switched on with 'e'
+*     -b baud     Beacon baud rate, 1200, 2400 or 4800 (default 2400)
+*     -g ticks    Beacon inter-frame gap, "gap N" on the console (default 1)
+*     -n frames   Stop after this many traced frames (default: until Ctrl-C)
+*     -S chars    Side characters of the beacon: four characters, or its config.h (default xcVM)
+*     -H file     Export the latency histogram of every stage as CSV
+*     -q          Do not print the published frames
+*
+* In trace mode the beacon reports every LINK_TRACE_INTERVAL-th frame's number (counter())
+* and the tick it started on. Frames are sent on a fixed grid of ticks, so these reports
+* give the emission tick of every frame in between. Each received byte is dated by the
+* latency compensation stage (latcomp.c) and correlated with a frame; that frame number is
+* its correlation ID through the whole path:
+*
+*   emit      Frame leaves TaskDriver()              beacon tick, mapped to the host clock
+*   link      Byte received by the converter          reconstructed by latcomp.c
+*   usb       Batch returned by read()                host clock
+*   decode    Byte attributed to its side             host clock
+*   estimate  Spin estimate updated (CraftDecode())   host clock
+*   publish   Result line written and flushed         host clock
+*
+* The beacon's ticks are mapped to the host clock by a line fitted to the lower envelope
+* of the trace reports: the report in each window of ENVELOPE_REPORTS that arrived soonest
+* after its own serial transmission time is one point of a least-squares fit. The fit
+* gives the clock offset and the beacon's drift against the host, so the link stage
+* excludes the console's shortest delay (about one USB frame) and does not slip on long
+* runs.
+*
+* The frames carry no ID, so a byte's ID is inferred: it is the last frame on the fitted
+* grid that could have been received whole by the byte's reconstructed time (less
+* ID_MARGIN_US). The link stage is therefore measured against the fit, from the frame's
+* fitted emission, and is known only modulo one frame period above its physical minimum.
+* Bytes whose IDs disagree with the spacing of their reception times are counted as
+* ambiguous: there the link or latcomp error is larger than the IDs can resolve.
+* The report gives p50/p99/max per stage. The grid assumes one frame per LinkFramePeriod()
+* of the baud rate and gap given; changing either during a trace invalidates it. In TDMA
+* mode ('t' on the console) the guard ticks and the other sides' slots break the grid, so
+* the tool stops at the first trace report that carries a superframe.
+*
+* Build: cc -O2 -o latency latency.c craft.c latcomp.c capture.c link.c -lm
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>               // Req'd because we catch SIGINT
+#include <unistd.h>               // Req'd because we call getopt() and read()
+#include <fcntl.h>                // Req'd because we call open()
+#include <poll.h>                 // Req'd because we call poll()
+#include <termios.h>              // Req'd because we call cfsetspeed()
+#include <time.h>                 // Req'd because we call clock_gettime()
+
+#include "craft.h"                // Req'd because we call CraftDecode() and CraftCharsFromSpec()
+#include "latcomp.h"              // Req'd because we call LatCompBatch()
+#include "link.h"                 // Req'd because we call LinkSideOf()
+
+#define READ_BUFFER_SIZE      512
+#define LINE_SIZE             256
+#define POLL_MS               100
+#define ENVELOPE_REPORTS      8               // Trace reports per lower-envelope point
+#define ID_MARGIN_US          1000            // Reconstruction error tolerated before a byte's frame
+#define ID_GAP_US             100000          // Silence after which bytes are not compared with the last
+
+// Stages, in path order; each is timed from the one before it
+enum { ST_LINK, ST_USB, ST_DECODE, ST_ESTIMATE, ST_PUBLISH, ST_TOTAL, STAGES };
+static const char * const stageNames[STAGES] = { "link", "usb", "decode", "estimate", "publish", "total" };
+
+// Histogram: four bins per octave from 1 us
+#define HIST_PER_OCTAVE       4
+#define HIST_BINS             96
+
+typedef struct {
+  int64_t *v;
+  size_t   n, size;
+  unsigned long hist[HIST_BINS];
+} Stage;
+
+// Frame grid, anchored on the latest trace report, and the beacon-to-host clock fit:
+// host_us = offset_us + slope * beacon_us
+typedef struct {
+  int      valid;
+  int64_t  frame, tick;       // Unwrapped frame number and its start tick
+  double   offset_us, slope;
+  double   winX, winY;        // Lowest point of the current envelope window
+  unsigned winN;
+  double   sx, sy, sxx, sxy;  // Sums over the envelope points
+  unsigned long points, reports;
+} Grid;
+
+// Correlation of received bytes with frames
+typedef struct {
+  int      valid;
+  int64_t  id, t;             // Last byte's frame and reconstructed time
+  unsigned long bytes, ambiguous;
+} Correlation;
+
+static Stage stages[STAGES];
+static Grid grid;
+static Correlation corr;
+static CraftRegistry reg;
+static CraftDecoder dec;
+static LatComp lc;
+static int64_t startUs;
+static int quiet = 0;
+static int tdma = 0;                          // A trace report showed TDMA mode
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal ( int sig )
+{
+  (void) sig;
+  stop = 1;
+}
+
+/**
+nowUs()
+
+@return Monotonic time in microseconds since startUs.
+*/
+static int64_t nowUs ( void )
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - startUs;
+}
+
+static void record ( unsigned s, int64_t us )
+{
+  Stage *st = &stages[s];
+  int bin = us < 1 ? 0 : (int) (HIST_PER_OCTAVE * log2((double) us));
+
+  if (st->n == st->size) {
+    st->size = st->size ? 2 * st->size : 4096;
+    if ((st->v = realloc(st->v, st->size * sizeof(int64_t))) == NULL) {
+      perror("latency");
+      exit(1);
+    }
+  }
+  st->v[st->n++] = us;
+  st->hist[bin < HIST_BINS ? bin : HIST_BINS - 1]++;
+}
+
+static int cmpInt64 ( const void *a, const void *b )
+{
+  int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+unwrap()
+
+Extends a 16-bit beacon counter to the value nearest above the previous one.
+*/
+static int64_t unwrap ( int64_t last, unsigned raw )
+{
+  return last + (int64_t) ((raw - (unsigned) last) & 0xFFFF);
+}
+
+/**
+fitHost()
+
+@return Host time of a beacon time, by the current clock fit.
+*/
+static double fitHost ( double beacon_us )
+{
+  return grid.offset_us + grid.slope * beacon_us;
+}
+
+/**
+traceReport()
+
+Anchors the grid on one trace report and adds it to the clock fit.
+
+Each report gives a point (beacon time of its frame, host time it was sent at at the
+latest). Within a window of ENVELOPE_REPORTS reports, the point lowest against the
+current fit is kept; the kept points are fitted by least squares. Until two windows are
+complete, the slope is 1 and the offset the lowest point so far.
+
+@param  line is the console line.
+@param  arrival_us is when its last byte was read.
+@param  frameUs is the air time of one frame.
+*/
+static void traceReport ( const char *line, int64_t arrival_us, double frameUs )
+{
+  const char *p = strstr(line, LINK_TRACE_TAG);
+  unsigned frame, tick;
+  double x, y, d;
+
+  if (p == NULL || sscanf(p + strlen(LINK_TRACE_TAG), "%u tick %u", &frame, &tick) != 2) {
+    return;
+  }
+  if (strstr(p, " sf ") != NULL) {
+    tdma = 1;                                   // The beacon is in TDMA mode; main() gives up
+    return;
+  }
+  if (grid.valid) {
+    grid.frame = unwrap(grid.frame, frame);
+    grid.tick  = unwrap(grid.tick, tick);
+  } else {
+    grid.frame = frame;
+    grid.tick  = tick;
+    grid.slope = 1;
+  }
+
+  // The report is sent once the frame is out, and arrives after its own serial time
+  x = grid.tick * LINK_TICK_S * 1e6;
+  y = arrival_us - (strlen(line) + 2) * 10e6 / LINK_CONSOLE_BAUD - frameUs;
+  if (!grid.valid || (grid.points < 2 && y - x < grid.offset_us)) {
+    grid.offset_us = y - x;
+  }
+  if (grid.winN == 0 || y - fitHost(x) < grid.winY - fitHost(grid.winX)) {
+    grid.winX = x;
+    grid.winY = y;
+  }
+  if (++grid.winN == ENVELOPE_REPORTS) {
+    grid.sx  += grid.winX;
+    grid.sy  += grid.winY;
+    grid.sxx += grid.winX * grid.winX;
+    grid.sxy += grid.winX * grid.winY;
+    grid.points++;
+    grid.winN = 0;
+    d = grid.points * grid.sxx - grid.sx * grid.sx;
+    if (grid.points >= 2 && d > 0) {
+      grid.slope     = (grid.points * grid.sxy - grid.sx * grid.sy) / d;
+      grid.offset_us = (grid.sy - grid.slope * grid.sx) / grid.points;
+    }
+  }
+  grid.valid = 1;
+  grid.reports++;
+}
+
+/**
+console()
+
+Reads console lines and feeds the trace reports to the grid. Switches trace reports back
+on if the beacon says they went off.
+*/
+static void console ( int fd, double frameUs )
+{
+  static char line[LINE_SIZE];
+  static size_t len = 0;
+  char buf[READ_BUFFER_SIZE];
+  int64_t arrival;
+  ssize_t n, k;
+
+  if ((n = read(fd, buf, sizeof(buf))) <= 0) {
+    return;
+  }
+  arrival = nowUs();
+  for (k = 0; k < n; k++) {
+    if (buf[k] == '\n' || buf[k] == '\r') {
+      line[len] = '\0';
+      if (len) {
+        traceReport(line, arrival, frameUs);
+        if (strstr(line, "Trace reports off") && write(fd, "e", 1) != 1) {
+          perror("console");
+        }
+      }
+      len = 0;
+    } else if (len < LINE_SIZE - 1) {
+      line[len++] = buf[k];
+    }
+  }
+}
+
+/**
+receiver()
+
+Reads one batch from the receiver and takes every byte through decode, estimate and
+publish, recording the stages of those that fall on a traced grid. The link stage is
+timed from the fitted emission of the byte's inferred frame.
+*/
+static void receiver ( int fd, int64_t periodUs, double frameUs )
+{
+  unsigned char buf[READ_BUFFER_SIZE];
+  int64_t t[READ_BUFFER_SIZE], arrival, emit, id, tDecode, tEstimate, tPublish;
+  double tickUs = LINK_TICK_S * 1e6, period, emit0;
+  unsigned side, c;
+  ssize_t n, k;
+  int transition;
+
+  if ((n = read(fd, buf, sizeof(buf))) <= 0) {
+    return;
+  }
+  arrival = nowUs();
+  LatCompBatch(&lc, arrival, (unsigned) n, t);
+
+  for (k = 0; k < n; k++) {
+    side = LinkSideOf(buf[k]);
+    tDecode = nowUs();
+    c = CraftDecode(&dec, t[k], buf[k], &transition);
+    tEstimate = nowUs();
+    if (!quiet) {
+      printf("%.6f %c %u %+8.2f\n", t[k] / 1e6, side == LINK_SIDE_NONE ? '?' : linkSideChars[side],
+             c < reg.count ? dec.st[c].frames : 0, c < reg.count ? dec.st[c].rpm : 0.0);
+      fflush(stdout);
+    }
+    tPublish = nowUs();
+
+    if (!grid.valid) {
+      continue;
+    }
+    // Correlation ID: the last frame that could have been received whole by t[k]
+    period = periodUs * grid.slope;
+    emit0  = fitHost(grid.tick * tickUs);
+    id = grid.frame + (int64_t) floor((t[k] + ID_MARGIN_US - frameUs - emit0) / period);
+    emit = (int64_t) (emit0 + (id - grid.frame) * period);
+
+    // The IDs of successive bytes must advance as their reception times do
+    if (corr.valid && t[k] - corr.t < ID_GAP_US && id - corr.id != llround((t[k] - corr.t) / period)) {
+      corr.ambiguous++;
+    }
+    corr.valid = 1;
+    corr.id = id;
+    corr.t  = t[k];
+    corr.bytes++;
+
+    record(ST_LINK, t[k] - emit);
+    record(ST_USB, arrival - t[k]);
+    record(ST_DECODE, tDecode - arrival);
+    record(ST_ESTIMATE, tEstimate - tDecode);
+    record(ST_PUBLISH, tPublish - tEstimate);
+    record(ST_TOTAL, tPublish - emit);
+  }
+}
+
+static int openTty ( const char *path, int flags, speed_t speed )
+{
+  struct termios tio;
+  int fd;
+
+  if ((fd = open(path, flags | O_NOCTTY)) < 0) {
+    perror(path);
+    return -1;
+  }
+  if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetspeed(&tio, speed);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+/**
+report()
+
+Prints p50/p99/max per stage and optionally exports the histograms.
+*/
+static int report ( const char *histPath )
+{
+  unsigned s, b;
+  Stage *st;
+  FILE *f;
+
+  printf("# %lu trace reports, %lu frames traced\n", grid.reports, (unsigned long) stages[ST_TOTAL].n);
+  printf("# clock fit: offset %.3f ms, beacon drift %+.1f ppm, %lu envelope points\n",
+         grid.offset_us / 1e3, (grid.slope - 1) * 1e6, grid.points);
+  printf("# frame IDs are inferred from reception times, not carried in the frame: link is known\n"
+         "# modulo one frame period; %lu of %lu bytes ambiguous\n", corr.ambiguous, corr.bytes);
+  printf("# stage          p50 ms    p99 ms    max ms\n");
+  for (s = 0; s < STAGES; s++) {
+    st = &stages[s];
+    if (st->n == 0) {
+      continue;
+    }
+    qsort(st->v, st->n, sizeof(int64_t), cmpInt64);
+    printf("  %-10s %9.3f %9.3f %9.3f\n", stageNames[s], st->v[st->n / 2] / 1e3,
+           st->v[(size_t) (0.99 * (st->n - 1))] / 1e3, st->v[st->n - 1] / 1e3);
+  }
+  LatCompReport(&lc, stdout);
+
+  if (histPath == NULL) {
+    return 0;
+  }
+  if ((f = fopen(histPath, "w")) == NULL) {
+    perror(histPath);
+    return -1;
+  }
+  fprintf(f, "lo_us,hi_us");
+  for (s = 0; s < STAGES; s++) {
+    fprintf(f, ",%s", stageNames[s]);
+  }
+  fprintf(f, "\n");
+  for (b = 0; b < HIST_BINS; b++) {
+    fprintf(f, "%.1f,%.1f", b ? pow(2, (double) b / HIST_PER_OCTAVE) : 0,
+            pow(2, (double) (b + 1) / HIST_PER_OCTAVE));
+    for (s = 0; s < STAGES; s++) {
+      fprintf(f, ",%lu", stages[s].hist[b]);
+    }
+    fprintf(f, "\n");
+  }
+  return fclose(f);
+}
+
+int main ( int argc, char **argv )
+{
+  const char *conPath = NULL, *histPath = NULL;
+  unsigned baud = linkBaud[LINK_DEFAULT_BAUD], gap = LINK_GAP_TICKS, k;
+  unsigned long frames = 0;
+  struct pollfd pfd[2];
+  struct timespec ts;
+  int64_t periodUs;
+  double frameUs;
+  unsigned char chars[LINK_SIDES];
+  int opt, usage = 0, rc;
+
+  while ((opt = getopt(argc, argv, "c:b:g:n:S:H:q")) != -1) {
+    switch (opt) {
+      case 'c': conPath = optarg; break;
+      case 'b': baud = (unsigned) atoi(optarg); break;
+      case 'g': gap = (unsigned) atoi(optarg); break;
+      case 'n': frames = strtoul(optarg, NULL, 0); break;
+      case 'S':
+        if (CraftCharsFromSpec(optarg, chars) < 0) {
+          return 2;
+        }
+        LinkSetSideChars(chars);
+        break;
+      case 'H': histPath = optarg; break;
+      case 'q': quiet = 1; break;
+      default:  usage = 1; break;
+    }
+  }
+  if (usage || conPath == NULL || optind != argc - 1) {
+    fprintf(stderr, "usage: latency -c <console> [-b baud] [-g ticks] [-n frames] [-S chars] [-H hist.csv] [-q] <receiver>\n"
+                    "Frames are dated assuming one per LinkFramePeriod(baud, gap); TDMA ('t') is not supported.\n");
+    return 2;
+  }
+  for (k = 0; k < LINK_BAUD_RATES && linkBaud[k] != baud; k++);
+  if (k == LINK_BAUD_RATES) {
+    fprintf(stderr, "latency: -b must be a rate the transmitter sends (1200/2400/4800)\n");
+    return 2;
+  }
+  if (gap < 1 || gap > LINK_GAP_TICKS_MAX) {
+    fprintf(stderr, "latency: -g must be 1..%u ticks, as \"gap N\" on the console\n", LINK_GAP_TICKS_MAX);
+    return 2;
+  }
+
+  periodUs = (int64_t) (LinkFramePeriod(baud, gap) * 1e6);
+  frameUs  = LINK_FRAME_BITS * 1e6 / baud;
+  LatCompInit(&lc, periodUs, LATCOMP_DEFAULT_MAX_LATENCY_US);
+  CraftRegistryInit(&reg);
+  CraftAdd(&reg, "beacon", (const unsigned char *) linkSideChars);
+  CraftDecoderInit(&dec, &reg);
+
+  if ((pfd[0].fd = openTty(conPath, O_RDWR, B9600)) < 0 ||
+      (pfd[1].fd = openTty(argv[optind], O_RDONLY, baud == 1200 ? B1200 : baud == 4800 ? B4800 : B2400)) < 0) {
+    return 1;
+  }
+  pfd[0].events = pfd[1].events = POLLIN;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  startUs = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  signal(SIGINT, onSignal);
+
+  // Trace reports on; the console reader presses 'e' again if they went off
+  if (write(pfd[0].fd, "e", 1) != 1) {
+    perror(conPath);
+  }
+  while (!stop && !tdma && (frames == 0 || stages[ST_TOTAL].n < frames)) {
+    if (poll(pfd, 2, POLL_MS) <= 0) {
+      continue;
+    }
+    if (pfd[0].revents & POLLIN) {
+      console(pfd[0].fd, frameUs);
+    }
+    if (pfd[1].revents & POLLIN) {
+      receiver(pfd[1].fd, periodUs, frameUs);
+    } else if (pfd[1].revents & POLLHUP) {
+      break;                                    // Receiver FIFO or pty closed
+    }
+  }
+  if (write(pfd[0].fd, "e", 1) != 1) {
+    perror(conPath);
+  }
+  close(pfd[0].fd);
+  close(pfd[1].fd);
+  if (tdma) {
+    fprintf(stderr, "latency: the beacon is in TDMA mode, its frames are not one LinkFramePeriod() apart;"
+                    " press 't' on the console to switch it off\n");
+    return 1;
+  }
+
+  rc = report(histPath);
+  return rc < 0 ? 1 : 0;
+}
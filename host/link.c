@@ -0,0 +1,122 @@
+/**
+* @file link.c
+*
+* @brief Side lookup and link timing shared by the ground-station tools
+*
+* Side n is the character transmitted on P5.n, as listed in driver.c:
+*   P5.0: 'x'
+*   P5.1: 'c'
+*   P5.2: 'V'
+*   P5.3: 'M'
+*/
+
+#include "link.h"                 // Good to self-reference
+
+// Characters emitted by each side, indexed by P5 bit: SIDE_CHARS in config.h as shipped.
+// Tools decoding another unit set them with LinkSetSideChars() (-S).
+char linkSideChars[LINK_SIDES] = { 'x', 'c', 'V', 'M' };
+
+// Transmitted P5 values, element LINK_FRAME_BITS-1 first, as LEDarray in driver.c.
+const unsigned char linkLEDarray[LINK_FRAME_BITS] = {
+  0xFF, 0x40, 0x5F, 0x43, 0x55, 0x49, 0x5C, 0x46, 0x5A, 0x40
+};
+
+// Carrier output gating each side's LEDs, as toggled by '1'-'4' in ui.c.
+const char * const linkCarrierPins[LINK_SIDES] = { "P2.3", "P2.1", "P2.7", "P2.5" };
+
+// Baud rates in the order of signal.c baud[][].
+const unsigned int linkBaud[LINK_BAUD_RATES] = { 1200, 2400, 4800 };
+
+/**
+LinkSideOf()
+
+Maps a received character to the side that transmits it.
+
+@param  c is the received byte.
+@return Side index (P5 bit), or LINK_SIDE_NONE if 'c' is not a side character.
+*/
+unsigned int LinkSideOf ( unsigned char c )
+{
+  unsigned int s;
+
+  for (s = 0; s < LINK_SIDES; s++) {
+    if ((unsigned char) linkSideChars[s] == c) {
+      return s;
+    }
+  }
+  return LINK_SIDE_NONE;
+}
+
+/**
+LinkSetSideChars()
+
+Makes LinkSideOf() and linkSideChars[] follow a beacon built with other SIDE_CHARS.
+
+@param  chars holds the character of each side, P5.0 first.
+*/
+void LinkSetSideChars ( const unsigned char *chars )
+{
+  unsigned int s;
+
+  for (s = 0; s < LINK_SIDES; s++) {
+    linkSideChars[s] = (char) chars[s];
+  }
+}
+
+/**
+LinkPrbsNext()
+
+Byte a side sends after 'b' in PRBS test mode: its LFSR stepped 8 times, as prbsNext()
+in driver.c.
+
+@param  side is the side index.
+@param  b is the previous byte of that side.
+@return The following byte.
+*/
+unsigned char LinkPrbsNext ( unsigned int side, unsigned char b )
+{
+  static const unsigned char poly[LINK_SIDES] = LINK_PRBS_POLYS;
+  unsigned int state = b, k;
+
+  for (k = 0; k < 8; k++) {
+    state <<= 1;
+    if (state & 0x100) {
+      state ^= 0x100 | poly[side];
+    }
+  }
+  return (unsigned char) state;
+}
+
+/**
+LinkFrame()
+
+Builds the line levels of one frame as TaskDriver() sends it.
+
+@param  c is the character.
+@return Bit n is the level of bit slot n: slot 0 is the start bit (0), slots 1-8 the data
+        bits LSB first, slot 9 the stop bit (1).
+*/
+unsigned int LinkFrame ( unsigned char c )
+{
+  return ((unsigned int) c << LINK_START_BITS) | (1u << (LINK_FRAME_BITS-1));
+}
+
+/**
+LinkFramePeriod()
+
+Time between the starts of successive frames.
+TaskDriver() sends a frame with interrupts disabled and then calls OS_Delay(gapTicks),
+so the next frame starts on the tick boundary following the frame plus the gap.
+Ticks missed while interrupts were off are caught up by the Timer A ISR (CCR0 += reload).
+
+@param  baud is the bit rate in bps.
+@param  gapTicks is the OS_Delay() argument.
+@return Frame period in seconds.
+*/
+double LinkFramePeriod ( unsigned int baud, unsigned int gapTicks )
+{
+  double frame = (double) LINK_FRAME_BITS / baud;
+  unsigned int ticks = (unsigned int) (frame / LINK_TICK_S);
+
+  return (ticks + gapTicks) * LINK_TICK_S;
+}
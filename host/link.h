@@ -0,0 +1,65 @@
+/**
+* @file link.h
+*
+* @brief Ground-side description of the IR side-identification link
+*
+* Mirrors the constants the transmitter firmware (src/) is built with, so that
+* the host tools interpret received characters the same way the beacon sends them.
+*
+* @note Keep in step with driver.c (LEDarray) and signal.c (baud[][]).
+*/
+
+#ifndef __LINK_H
+#define __LINK_H
+
+// Frame layout, as in driver.h
+#define LINK_START_BITS     1
+#define LINK_DATA_BITS      8
+#define LINK_STOP_BITS      1
+#define LINK_FRAME_BITS     (LINK_START_BITS+LINK_DATA_BITS+LINK_STOP_BITS)
+
+// Baud rates selectable with 'a'/'z', as in signal.c baud[][]
+#define LINK_BAUD_RATES     3
+#define LINK_DEFAULT_BAUD   1              // Index of 2400 bps, the power-up setting
+
+// Salvo tick: Timer A on ACLK (32768 Hz) reloaded with TIMERA0_RELOAD (328), see main.h
+#define LINK_TICK_S         (328.0/32768.0)
+
+// Ticks TaskDriver() waits between frames, OS_Delay(1); "gap N" on the console sets 1..max,
+// as GAP_TICKS and GAP_TICKS_MAX in driver.h
+#define LINK_GAP_TICKS      1
+#define LINK_GAP_TICKS_MAX  100
+
+// Console (TaskUI) line rate
+#define LINK_CONSOLE_BAUD   9600
+
+// Trace mode ('e' on the console): frames between reports, as TRACE_INTERVAL in driver.h
+#define LINK_TRACE_INTERVAL 64
+#define LINK_TRACE_TAG      "Trace: frame "
+
+// TDMA mode ('t' on the console): frames per side slot and guard ticks after each slot at
+// power-up, as TDMA_SLOT_FRAMES and TDMA_GUARD_TICKS in driver.h ("slot N", "guard N")
+#define LINK_TDMA_SLOT_FRAMES  1
+#define LINK_TDMA_GUARD_TICKS  1
+
+// Number of lateral faces carrying a character
+#define LINK_SIDES          4
+
+// PRBS test mode: per-side 8-bit Galois LFSR polynomials, as PRBS_POLY_n in driver.h
+#define LINK_PRBS_POLYS     { 0x1D, 0x2B, 0x5F, 0x63 }
+
+// Returned by LinkSideOf() for characters that do not identify a side
+#define LINK_SIDE_NONE      0xFF
+
+extern char linkSideChars[LINK_SIDES];
+extern const unsigned int linkBaud[LINK_BAUD_RATES];
+extern const unsigned char linkLEDarray[LINK_FRAME_BITS];
+extern const char * const linkCarrierPins[LINK_SIDES];
+
+extern unsigned int LinkSideOf ( unsigned char c );
+extern void LinkSetSideChars ( const unsigned char *chars );
+extern unsigned int LinkFrame ( unsigned char c );
+extern unsigned char LinkPrbsNext ( unsigned int side, unsigned char b );
+extern double LinkFramePeriod ( unsigned int baud, unsigned int gapTicks );
+
+#endif /* __LINK_H */
@@ -0,0 +1,314 @@
+/**
+* @file retime.c
+*
+* @brief Removes USB-serial batching jitter from received side-event timestamps
+*
+* Usage:
+*   retime [-b baud] [-g ticks] [-L ms] [-u ms] [-s seed] [-S chars] [-o out.cap] [-q] <input>
+*     -b baud     Transmitter baud rate, 1200, 2400 or 4800 (default 2400)
+*     -g ticks    Transmitter inter-frame gap, "gap N" on the console (default 1)
+*     -L ms       Longest converter latency (default 17)
+*     -u ms       Latency timer of the simulated converter (default 16)
+*     -s seed     Random seed of the simulated converter (default 1)
+*     -S chars    Side characters of the beacon: four characters, or its config.h (default xcVM)
+*     -o file     Write the retimed events to a capture file instead of printing them
+*     -q          Only print the report
+*
+*   A serial device, pty or FIFO is read live: every read() is one converter batch, timed
+*   on arrival, and its bytes are dated by the reconstruction stage (latcomp.c).
+*
+*   A capture file (*.cap) is taken as ground truth: its records are batched as the
+*   simulated converter would deliver them, retimed, and compared with the recorded times.
+*   The report then gives the error of the naive dating (arrival less one frame period per
+*   byte still queued behind it) next to that of the reconstruction.
+*
+*   Both assume one frame per LinkFramePeriod() of the baud rate and gap given. A beacon in
+*   TDMA mode ('t' on the console) leaves its guard ticks and the other sides' slots between
+*   frames, which this grid cannot express; switch TDMA off while retiming.
+*
+* Build: cc -O2 -o retime retime.c latcomp.c capture.c craft.c link.c rnd.c -lm
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>               // Req'd because we catch SIGINT
+#include <unistd.h>               // Req'd because we call getopt() and read()
+#include <fcntl.h>                // Req'd because we call open()
+#include <termios.h>              // Req'd because we call cfsetspeed()
+#include <time.h>                 // Req'd because we call clock_gettime()
+#include <sys/stat.h>             // Req'd because we call fstat()
+
+#include "capture.h"              // Req'd because we call CapBlock() and CapAppend()
+#include "craft.h"                // Req'd because we call CraftCharsFromSpec()
+#include "latcomp.h"              // Req'd because we call LatCompBatch()
+#include "link.h"                 // Req'd because we call LinkFramePeriod()
+#include "rnd.h"                  // Req'd because we call Rnd64()
+
+#define READ_BUFFER_SIZE      512
+#define CONVERTER_FIFO        62              // Payload bytes after which a converter sends at once
+#define USB_FRAME_US          1000            // Host polls the converter once per USB frame
+
+typedef struct {
+  double  *v;
+  size_t   n, size;
+} Errors;
+
+static LatComp lc;
+static CapWriter w;
+static const char *outPath = NULL;
+static int quiet = 0;
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal ( int sig )
+{
+  (void) sig;
+  stop = 1;
+}
+
+static void addError ( Errors *e, double v )
+{
+  if (e->n == e->size) {
+    e->size = e->size ? 2 * e->size : 4096;
+    if ((e->v = realloc(e->v, e->size * sizeof(double))) == NULL) {
+      perror("retime");
+      exit(1);
+    }
+  }
+  e->v[e->n++] = v;
+}
+
+static int cmpDouble ( const void *a, const void *b )
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+reportErrors()
+
+Prints the constant offset of a set of timestamp errors and the spread around it.
+The offset (the converter's shortest delay, fixed serial latency) is the same for every
+byte and cancels out of spin rates; the spread does not.
+*/
+static void reportErrors ( const char *name, Errors *e )
+{
+  double mean = 0, sq = 0;
+  size_t i;
+
+  if (e->n == 0) {
+    return;
+  }
+  for (i = 0; i < e->n; i++) {
+    mean += e->v[i];
+  }
+  mean /= e->n;
+  for (i = 0; i < e->n; i++) {
+    e->v[i] = fabs(e->v[i] - mean);
+    sq += e->v[i] * e->v[i];
+  }
+  qsort(e->v, e->n, sizeof(double), cmpDouble);
+  printf("  %-14s %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, mean / 1e3, sqrt(sq / e->n) / 1e3,
+         e->v[e->n / 2] / 1e3, e->v[(size_t) (0.99 * (e->n - 1))] / 1e3, e->v[e->n - 1] / 1e3);
+}
+
+/**
+emit()
+
+Prints or records one retimed byte.
+*/
+static void emit ( int64_t t, unsigned char ch, const CapRecord *src, uint32_t seq )
+{
+  CapRecord r;
+
+  if (outPath) {
+    if (src) {
+      r = *src;
+    } else {
+      memset(&r, 0, sizeof(r));
+      r.seq  = seq;
+      r.ch   = ch;
+      r.side = (uint8_t) LinkSideOf(ch);
+      r.flags = r.side == LINK_SIDE_NONE ? CAP_FLAG_UNKNOWN : 0;
+    }
+    r.t_us = t;
+    r.flags |= CAP_FLAG_SYNTH_TIME;
+    CapAppend(&w, &r);
+  } else if (!quiet) {
+    printf("%.6f %c\n", t / 1e6, ch >= 0x20 && ch < 0x7F ? ch : '.');
+  }
+}
+
+/**
+simulate()
+
+Batches the records of a capture through a simulated converter, retimes them and compares
+both datings with the recorded times.
+
+The converter sends whatever it holds each time its free-running latency timer expires, or
+at once when its FIFO fills. The host picks the batch up at its next USB frame.
+*/
+static int simulate ( const char *path, int64_t timer_us, uint64_t seed )
+{
+  CapReader rd;
+  const CapRecord *r, *pending[CONVERTER_FIFO];
+  int64_t t[CONVERTER_FIFO], flush, arrival;
+  uint32_t i, n;
+  unsigned k, np = 0;
+  size_t b;
+  Errors naive = { 0 }, rebuilt = { 0 };
+
+  if (CapOpenRead(&rd, path) < 0) {
+    return -1;
+  }
+  flush = -(int64_t) (Rnd64(&seed) % (uint64_t) timer_us);
+
+  for (b = 0; b <= rd.blocks && !stop; b++) {
+    r = b < rd.blocks ? CapBlock(&rd, b, &n) : NULL;
+    for (i = 0; i < (r ? n : 1); i++) {
+      // Deliver every batch due before this record (all of them after the last one)
+      while (np && (r == NULL || np == CONVERTER_FIFO || r[i].t_us > flush)) {
+        arrival = (np == CONVERTER_FIFO ? pending[np-1]->t_us : flush)
+                + USB_FRAME_US - (int64_t) (Rnd64(&seed) % USB_FRAME_US);
+        LatCompBatch(&lc, arrival, np, t);
+        for (k = 0; k < np; k++) {
+          addError(&naive, (double) (arrival - (int64_t) (np - 1 - k) * lc.period_us - pending[k]->t_us));
+          addError(&rebuilt, (double) (t[k] - pending[k]->t_us));
+          emit(t[k], pending[k]->ch, pending[k], 0);
+        }
+        np = 0;
+      }
+      if (r == NULL) {
+        break;
+      }
+      while (r[i].t_us > flush) {
+        flush += timer_us;
+      }
+      pending[np++] = &r[i];
+    }
+  }
+
+  LatCompReport(&lc, stdout);
+  printf("# timestamp error against the capture, ms\n");
+  printf("# dating           offset       rms       p50       p99       max\n");
+  reportErrors("naive", &naive);
+  reportErrors("reconstructed", &rebuilt);
+  free(naive.v);
+  free(rebuilt.v);
+  CapCloseRead(&rd);
+  return 0;
+}
+
+/**
+live()
+
+Retimes a serial device, pty or FIFO as it is read.
+*/
+static int live ( const char *path, unsigned baud )
+{
+  unsigned char buf[READ_BUFFER_SIZE];
+  int64_t t[READ_BUFFER_SIZE], arrival, start;
+  struct termios tio;
+  struct timespec ts;
+  struct stat st;
+  uint32_t seq = 0;
+  ssize_t n, k;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_NOCTTY)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    return -1;
+  }
+  if (S_ISREG(st.st_mode)) {
+    fprintf(stderr, "%s: a raw byte file has no arrival times; use a device or a capture\n", path);
+    close(fd);
+    return -1;
+  }
+  if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetspeed(&tio, baud == 1200 ? B1200 : baud == 4800 ? B4800 : B2400);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  start = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+  while (!stop && (n = read(fd, buf, sizeof(buf))) > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    arrival = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - start;
+    LatCompBatch(&lc, arrival, (unsigned) n, t);
+    for (k = 0; k < n; k++) {
+      emit(t[k], buf[k], NULL, seq++);
+    }
+    if (!outPath) {
+      fflush(stdout);
+    }
+  }
+  close(fd);
+  LatCompReport(&lc, stdout);
+  return 0;
+}
+
+int main ( int argc, char **argv )
+{
+  unsigned baud = linkBaud[LINK_DEFAULT_BAUD], gap = LINK_GAP_TICKS, k;
+  double maxLatency = LATCOMP_DEFAULT_MAX_LATENCY_US / 1e3, timer = 16;
+  uint64_t seed = 1;
+  const char *in;
+  size_t len;
+  unsigned char chars[LINK_SIDES];
+  int opt, rc, usage = 0;
+
+  while ((opt = getopt(argc, argv, "b:g:L:u:s:S:o:q")) != -1) {
+    switch (opt) {
+      case 'b': baud = (unsigned) atoi(optarg); break;
+      case 'g': gap = (unsigned) atoi(optarg); break;
+      case 'L': maxLatency = atof(optarg); break;
+      case 'u': timer = atof(optarg); break;
+      case 's': seed = strtoull(optarg, NULL, 0); break;
+      case 'S':
+        if (CraftCharsFromSpec(optarg, chars) < 0) {
+          return 2;
+        }
+        LinkSetSideChars(chars);
+        break;
+      case 'o': outPath = optarg; break;
+      case 'q': quiet = 1; break;
+      default:  usage = 1; break;
+    }
+  }
+  if (usage || optind != argc - 1 || timer < 0.001) {
+    fprintf(stderr, "usage: retime [-b baud] [-g ticks] [-L ms] [-u ms] [-s seed] [-S chars] [-o out.cap] [-q] <input>\n"
+                    "Bytes are dated assuming one frame per LinkFramePeriod(baud, gap); TDMA ('t') is not supported.\n");
+    return 2;
+  }
+  for (k = 0; k < LINK_BAUD_RATES && linkBaud[k] != baud; k++);
+  if (k == LINK_BAUD_RATES) {
+    fprintf(stderr, "retime: -b must be a rate the transmitter sends (1200/2400/4800)\n");
+    return 2;
+  }
+  if (gap < 1 || gap > LINK_GAP_TICKS_MAX) {
+    fprintf(stderr, "retime: -g must be 1..%u ticks, as \"gap N\" on the console\n", LINK_GAP_TICKS_MAX);
+    return 2;
+  }
+
+  LatCompInit(&lc, (int64_t) (LinkFramePeriod(baud, gap) * 1e6), (int64_t) (maxLatency * 1e3));
+  if (outPath && CapOpenWrite(&w, outPath, 0) < 0) {
+    return 1;
+  }
+  signal(SIGINT, onSignal);
+
+  in = argv[optind];
+  len = strlen(in);
+  if (len > 4 && strcmp(in + len - 4, ".cap") == 0) {
+    rc = simulate(in, (int64_t) (timer * 1e3), seed);
+  } else {
+    rc = live(in, baud);
+  }
+  if (outPath && CapClose(&w) < 0) {
+    return 1;
+  }
+  return rc < 0 ? 1 : 0;
+}
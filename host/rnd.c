@@ -0,0 +1,37 @@
+/**
+* @file rnd.c
+*
+* @brief Seedable random numbers for the simulating tools (spinsim, retime)
+*
+* splitmix64: the whole state is one 64-bit word owned by the caller, so every run or
+* thread can carry its own and results do not depend on scheduling.
+*/
+
+#include <stdint.h>
+
+#include "rnd.h"                  // Good to self-reference
+
+/**
+Rnd64()
+
+@param  s is the generator state, advanced by one step.
+@return 64 random bits.
+*/
+uint64_t Rnd64 ( uint64_t *s )
+{
+  uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/**
+RndUnit()
+
+@param  s is the generator state, advanced by one step.
+@return A uniform double in [0, 1), with 53 random bits.
+*/
+double RndUnit ( uint64_t *s )
+{
+  return (Rnd64(s) >> 11) * (1.0 / 9007199254740992.0);
+}
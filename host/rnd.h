@@ -0,0 +1,17 @@
+/**
+* @file rnd.h
+*
+* @brief Header file for rnd.c
+*
+* Small seedable random number generator shared by the simulating tools.
+*/
+
+#ifndef __RND_H
+#define __RND_H
+
+#include <stdint.h>
+
+extern uint64_t Rnd64 ( uint64_t *s );
+extern double   RndUnit ( uint64_t *s );
+
+#endif /* __RND_H */
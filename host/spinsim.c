@@ -0,0 +1,481 @@
+/**
+* @file spinsim.c
+*
+* @brief Monte-Carlo simulator of the side-identification link on a spinning CubeSat
+*
+* Usage:
+*   spinsim [options]
+*     -b baud     Transmit baud rate, one of 1200/2400/4800 (default 2400)
+*     -g ticks    Inter-frame gap, the OS_Delay() argument in TaskDriver() (default 1)
+*     -r a:b:s    Spin rates to sweep in rpm, from a to b in steps of s (default 10:1800:10)
+*     -a alpha    Largest angular acceleration in deg/s^2, drawn uniformly +-alpha (default 20)
+*     -f fov      Half-angle in degrees within which a face's LEDs reach the receiver (default 50)
+*     -e ber      Bit error rate with a face on boresight (default 1e-4)
+*     -E ber      Bit error rate at the edge of the field of view (default 1e-2)
+*     -T secs     Observation window per run (default 2)
+*     -n runs     Runs per spin rate (default 1000)
+*     -t tol      Relative spin-rate error still counted as a success (default 0.05)
+*     -j threads  Worker threads (default: online CPUs)
+*     -s seed     Random seed (default 1)
+*     -D s:g      TDMA mode ('t' on the console) with s frames per slot and g guard ticks
+*     -S chars    Side characters sent: four characters, or a config.h (default xcVM)
+*     -o file     Also write the received byte stream of one run at the first rate to a capture
+*
+* Model:
+* - The four lateral faces carry sides 0-3 (P5.0-P5.3) with normals 90 degrees apart,
+*   side index increasing counter-clockwise. The receiver lies in the spin plane.
+* - All four sides start their frames together, as TaskDriver() writes all of P5 at once,
+*   once per LinkFramePeriod(). Line level per bit slot is the AND of the visible faces'
+*   levels: an IR burst (space, 0) from any face wins. No face visible reads as idle (1).
+*   Overlapping faces near a corner therefore collide, and a face entering or leaving the
+*   field of view mid-frame yields a partial frame.
+* - In TDMA mode the sides instead take turns: a superframe holds one slot per side, P5.0
+*   first, each of 's' frames one LinkFramePeriod() apart, then 'g' silent guard ticks.
+*   Only the slot's side drives the line, so faces never collide, at 1/(4+4g/s) of the
+*   frame rate per side.
+* - Each bit slot is flipped with a probability interpolated logarithmically between the
+*   boresight and edge BER of the best-aligned visible face.
+* - The receiver UART starts on the first space in a frame's slots and reads the ten slots
+*   from there, so partial frames decode to shifted bytes, as a real UART would.
+*
+* The estimator sees only the decoded bytes and their times. It marks a face transition
+* halfway between the last byte of one side and the first of the next, unwraps the
+* transitions into a rotation angle (90 degrees each) and fits angle(t) with a quadratic.
+* Spin rate and direction are scored against the true rate at the middle of the window.
+*
+* Output is CSV on stdout, one line per spin rate. Besides the accuracy it gives the rate of
+* decoded side events overall and at corners (two faces in view), to weigh TDMA against
+* the throughput it costs.
+*
+* Build: cc -O2 -pthread -o spinsim spinsim.c capture.c craft.c link.c rnd.c -lm
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>               // Req'd because we call getopt() and sysconf()
+#include <pthread.h>              // Req'd because we call pthread_create()
+
+#include "capture.h"              // Req'd because we call CapAppend()
+#include "craft.h"                // Req'd because we call CraftCharsFromSpec()
+#include "link.h"                 // Req'd because we call LinkFrame() and LinkFramePeriod()
+#include "rnd.h"                  // Req'd because we call Rnd64() and RndUnit()
+
+#define MAX_THREADS           256
+#define DEG                   (M_PI/180.0)
+
+typedef struct {
+  unsigned baud, gapTicks, runs;
+  double   rpmFrom, rpmTo, rpmStep;
+  double   alphaMax;          // rad/s^2
+  double   halfFov;           // rad
+  double   ber0, berEdge;
+  double   window;            // s
+  double   tol;
+  uint64_t seed;
+  unsigned tdmaSlot;          // Frames per TDMA slot, 0 for all sides at once
+  unsigned tdmaGuard;         // Guard ticks after each TDMA slot
+} Config;
+
+// Outcome of one run
+typedef struct {
+  float    relErr;            // |omega_est - omega| / |omega|, INFINITY if no estimate
+  float    alphaErr;          // |alpha_est - alpha| in deg/s^2, NAN if not estimated
+  uint8_t  dirOk;
+  uint32_t frames, decoded, collisions;
+  uint32_t cornerDecoded;     // Decoded frames sent while two faces were in view
+} Result;
+
+typedef struct {
+  const Config *cfg;
+  Result       *results;      // [point][run]
+  unsigned      points;
+  unsigned      next;         // Next work item, taken atomically
+} Sweep;
+
+/**
+offAxis()
+
+@return Angle between side 's' normal and the receiver direction, in [0, pi].
+*/
+static double offAxis ( double theta, unsigned s )
+{
+  double a = fmod(theta + s * (M_PI/2), 2*M_PI);
+
+  if (a < 0) {
+    a += 2*M_PI;
+  }
+  return a > M_PI ? 2*M_PI - a : a;
+}
+
+/**
+fitAngle()
+
+Least squares fit of phi = c0 + c1 t + c2 t^2 (c2 = 0 when fewer than 3 points).
+Times are taken relative to 'tRef' so c1 is the rate at tRef.
+*/
+static int fitAngle ( const double *t, const double *phi, unsigned n, double tRef,
+                      double *omega, double *alpha )
+{
+  double s[5] = { 0 }, r[3] = { 0 }, x, x2, det, c1, c2;
+  double a00, a01, a02, a11, a12, a22;
+  unsigned i;
+
+  if (n < 2) {
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    x = t[i] - tRef;
+    x2 = x * x;
+    s[0] += 1;  s[1] += x;  s[2] += x2;  s[3] += x2 * x;  s[4] += x2 * x2;
+    r[0] += phi[i];  r[1] += phi[i] * x;  r[2] += phi[i] * x2;
+  }
+
+  if (n < 3) {
+    det = s[0] * s[2] - s[1] * s[1];
+    if (det == 0) {
+      return -1;
+    }
+    *omega = (s[0] * r[1] - s[1] * r[0]) / det;
+    *alpha = NAN;
+    return 0;
+  }
+
+  // Normal equations, solved by Cramer's rule
+  a00 = s[0]; a01 = s[1]; a02 = s[2]; a11 = s[2]; a12 = s[3]; a22 = s[4];
+  det = a00 * (a11 * a22 - a12 * a12) - a01 * (a01 * a22 - a12 * a02) + a02 * (a01 * a12 - a11 * a02);
+  if (fabs(det) < 1e-18) {
+    return -1;
+  }
+  c1 = (a00 * (r[1] * a22 - a12 * r[2]) - r[0] * (a01 * a22 - a12 * a02) + a02 * (a01 * r[2] - r[1] * a02)) / det;
+  c2 = (a00 * (a11 * r[2] - r[1] * a12) - a01 * (a01 * r[2] - r[1] * a02) + r[0] * (a01 * a12 - a11 * a02)) / det;
+  *omega = c1;
+  *alpha = 2 * c2;
+  return 0;
+}
+
+/**
+frameStart()
+
+@return Start of frame n relative to the first, and in 'slot' the side allowed to send it
+        (LINK_SIDES for all of them).
+*/
+static double frameStart ( const Config *cfg, double period, unsigned n, unsigned *slot )
+{
+  unsigned perSuper, r;
+  double slotLen;
+
+  if (cfg->tdmaSlot == 0) {
+    *slot = LINK_SIDES;
+    return n * period;
+  }
+  perSuper = LINK_SIDES * cfg->tdmaSlot;
+  r = n % perSuper;
+  *slot = r / cfg->tdmaSlot;
+  slotLen = cfg->tdmaSlot * period + cfg->tdmaGuard * LINK_TICK_S;
+  return (n / perSuper) * LINK_SIDES * slotLen + *slot * slotLen + (r % cfg->tdmaSlot) * period;
+}
+
+/**
+simulate()
+
+One run: generates the received byte stream and scores the estimate.
+
+@param  cfg is the sweep configuration.
+@param  rpm is the nominal spin rate; its sign is drawn at random.
+@param  seed seeds this run's random stream.
+@param  tBuf, phiBuf are scratch arrays of at least one entry per frame.
+@param  out, if not NULL, receives every decoded byte.
+*/
+static Result simulate ( const Config *cfg, double rpm, uint64_t seed,
+                         double *tBuf, double *phiBuf, CapWriter *out )
+{
+  const double period = LinkFramePeriod(cfg->baud, cfg->gapTicks);
+  const double bit = 1.0 / cfg->baud;
+  const double cosFov = cos(cfg->halfFov);
+  const double berRatio = log(cfg->berEdge / cfg->ber0);
+  Result res = { INFINITY, NAN, 0, 0, 0, 0, 0 };
+  uint64_t rng = seed;
+  double omega = rpm * 2 * M_PI / 60;
+  double alpha, theta0, t0, t, theta, off, best, omegaRef, omegaEst, alphaEst;
+  double lastT = 0, phi = 0, tMid = cfg->window / 2;
+  unsigned n, k, s, lastSide = LINK_SIDE_NONE, side, slots, level, visible, sending, start, byte, nTr = 0;
+  unsigned slot;
+  int votes = 0, step;
+  CapRecord rec;
+
+  if (Rnd64(&rng) & 1) {
+    omega = -omega;
+  }
+  alpha  = (2 * RndUnit(&rng) - 1) * cfg->alphaMax;
+  theta0 = RndUnit(&rng) * 2 * M_PI;
+  t0     = RndUnit(&rng) * period;              // Frame phase
+
+  for (n = 0; (t = t0 + frameStart(cfg, period, n, &slot)) + LINK_FRAME_BITS * bit < cfg->window; n++) {
+    res.frames++;
+    slots = 0;
+    visible = sending = 0;
+    for (k = 0; k < LINK_FRAME_BITS; k++) {
+      double tc = t + (k + 0.5) * bit;
+      theta = theta0 + omega * tc + 0.5 * alpha * tc * tc;
+      level = 1;
+      best = M_PI;
+      for (s = 0; s < LINK_SIDES; s++) {
+        off = offAxis(theta, s);
+        if (cos(off) > cosFov) {
+          visible |= 1u << s;
+          if (slot != LINK_SIDES && slot != s) {
+            continue;                           // Held idle outside its TDMA slot
+          }
+          sending |= 1u << s;
+          level &= (LinkFrame((unsigned char) linkSideChars[s]) >> k) & 1;
+          if (off < best) {
+            best = off;
+          }
+        }
+      }
+      if (best < M_PI && RndUnit(&rng) < cfg->ber0 * exp(berRatio * best / cfg->halfFov)) {
+        level ^= 1;
+      }
+      slots |= level << k;
+    }
+    if (sending & (sending - 1)) {
+      res.collisions++;
+    }
+
+    // Receiver UART: start on the first space, idle (1) after the end of the frame
+    for (start = 0; start < LINK_FRAME_BITS && ((slots >> start) & 1); start++);
+    if (start == LINK_FRAME_BITS) {
+      continue;
+    }
+    slots = (slots >> start) | (~0u << (LINK_FRAME_BITS - start));
+    byte = (slots >> LINK_START_BITS) & 0xFF;
+    t += (start + LINK_FRAME_BITS) * bit;       // Byte is delivered at the end of its stop bit
+
+    if (out) {
+      rec.t_us  = (int64_t) (t * 1e6);
+      rec.seq   = n;
+      rec.ch    = (uint8_t) byte;
+      rec.side  = (uint8_t) LinkSideOf((unsigned char) byte);
+      rec.flags = (((slots >> (LINK_FRAME_BITS - 1)) & 1) ? 0 : CAP_FLAG_FRAMING)
+                | (rec.side == LINK_SIDE_NONE ? CAP_FLAG_UNKNOWN : 0);
+      CapAppend(out, &rec);
+    }
+    if (!((slots >> (LINK_FRAME_BITS - 1)) & 1)) {
+      continue;                                 // Framing error
+    }
+    if ((side = LinkSideOf((unsigned char) byte)) == LINK_SIDE_NONE) {
+      continue;
+    }
+    res.decoded++;
+    if (visible & (visible - 1)) {
+      res.cornerDecoded++;
+    }
+
+    // Face transition: unwrap the side change into a signed rotation
+    if (lastSide != LINK_SIDE_NONE && side != lastSide) {
+      step = (int) ((lastSide - side + LINK_SIDES) % LINK_SIDES);   // +1: counter-clockwise
+      if (step == 3) {
+        step = -1;
+      } else if (step == 2) {
+        step = votes >= 0 ? 2 : -2;               // A face was missed; assume the usual direction
+      }
+      votes += step > 0 ? 1 : -1;
+      phi += step * (M_PI/2);
+      tBuf[nTr] = 0.5 * (lastT + t);
+      phiBuf[nTr++] = phi;
+    }
+    lastSide = side;
+    lastT = t;
+  }
+
+  if (fitAngle(tBuf, phiBuf, nTr, tMid, &omegaEst, &alphaEst) == 0) {
+    omegaRef = omega + alpha * tMid;
+    res.relErr = (float) fabs((omegaEst - omegaRef) / omegaRef);
+    res.dirOk = (omegaEst > 0) == (omegaRef > 0);
+    if (!isnan(alphaEst)) {
+      res.alphaErr = (float) (fabs(alphaEst - alpha) / DEG);
+    }
+  }
+  return res;
+}
+
+/**
+worker()
+
+Thread body: takes (rate, run) items until the sweep is exhausted.
+*/
+static void *worker ( void *arg )
+{
+  Sweep *sw = arg;
+  const Config *cfg = sw->cfg;
+  size_t maxFrames = (size_t) (cfg->window / LinkFramePeriod(cfg->baud, cfg->gapTicks)) + 2;
+  double *tBuf = malloc(maxFrames * sizeof(double));
+  double *phiBuf = malloc(maxFrames * sizeof(double));
+  unsigned item, p;
+
+  if (tBuf == NULL || phiBuf == NULL) {
+    fprintf(stderr, "spinsim: out of memory\n");
+    exit(1);
+  }
+  while ((item = __atomic_fetch_add(&sw->next, 1, __ATOMIC_RELAXED)) < sw->points * cfg->runs) {
+    p = item / cfg->runs;
+    sw->results[item] = simulate(cfg, cfg->rpmFrom + p * cfg->rpmStep,
+                                 cfg->seed * 0x100000001B3ULL + item, tBuf, phiBuf, NULL);
+  }
+  free(tBuf);
+  free(phiBuf);
+  return NULL;
+}
+
+static int cmpFloat ( const void *a, const void *b )
+{
+  float x = *(const float *) a, y = *(const float *) b;
+  return (x > y) - (x < y);
+}
+
+int main ( int argc, char **argv )
+{
+  Config cfg = { 2400, LINK_GAP_TICKS, 1000, 10, 1800, 10, 20*DEG, 50*DEG, 1e-4, 1e-2, 2.0, 0.05, 1, 0, 0 };
+  pthread_t tid[MAX_THREADS];
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *outPath = NULL;
+  Sweep sw;
+  Result *r;
+  float *err;
+  unsigned p, i, k, ok, dirOk, alphaN;
+  double frames, decoded, collisions, corner, alphaSum, fps, fpsSide;
+  size_t maxFrames;
+  unsigned char chars[LINK_SIDES];
+  CapWriter w;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:g:r:a:f:e:E:T:n:t:j:s:D:S:o:")) != -1) {
+    switch (opt) {
+      case 'b': cfg.baud = (unsigned) atoi(optarg); break;
+      case 'g': cfg.gapTicks = (unsigned) atoi(optarg); break;
+      case 'r':
+        if (sscanf(optarg, "%lf:%lf:%lf", &cfg.rpmFrom, &cfg.rpmTo, &cfg.rpmStep) != 3) {
+          fprintf(stderr, "spinsim: -r expects from:to:step\n");
+          return 2;
+        }
+        break;
+      case 'a': cfg.alphaMax = atof(optarg) * DEG; break;
+      case 'f': cfg.halfFov = atof(optarg) * DEG; break;
+      case 'e': cfg.ber0 = atof(optarg); break;
+      case 'E': cfg.berEdge = atof(optarg); break;
+      case 'T': cfg.window = atof(optarg); break;
+      case 'n': cfg.runs = (unsigned) atoi(optarg); break;
+      case 't': cfg.tol = atof(optarg); break;
+      case 'j': threads = atol(optarg); break;
+      case 's': cfg.seed = strtoull(optarg, NULL, 0); break;
+      case 'D':
+        if (sscanf(optarg, "%u:%u", &cfg.tdmaSlot, &cfg.tdmaGuard) != 2 || cfg.tdmaSlot == 0) {
+          fprintf(stderr, "spinsim: -D expects frames:guard, at least one frame per slot\n");
+          return 2;
+        }
+        break;
+      case 'S':
+        if (CraftCharsFromSpec(optarg, chars) < 0) {
+          return 2;
+        }
+        LinkSetSideChars(chars);
+        break;
+      case 'o': outPath = optarg; break;
+      default:
+        fprintf(stderr, "usage: spinsim [-b baud] [-g ticks] [-r from:to:step] [-a alpha] [-f fov]\n"
+                        "               [-e ber] [-E ber] [-T secs] [-n runs] [-t tol] [-j threads]\n"
+                        "               [-s seed] [-D slot:guard] [-S chars] [-o stream.cap]\n");
+        return 2;
+    }
+  }
+  for (k = 0; k < LINK_BAUD_RATES && linkBaud[k] != cfg.baud; k++);
+  if (k == LINK_BAUD_RATES) {
+    fprintf(stderr, "spinsim: -b must be a rate the transmitter sends (1200/2400/4800)\n");
+    return 2;
+  }
+  if (cfg.rpmStep <= 0 || cfg.rpmTo < cfg.rpmFrom || cfg.runs == 0
+      || cfg.ber0 <= 0 || cfg.berEdge <= 0 || cfg.window <= 0) {
+    fprintf(stderr, "spinsim: invalid arguments\n");
+    return 2;
+  }
+  if (threads < 1) {
+    threads = 1;
+  } else if (threads > MAX_THREADS) {
+    threads = MAX_THREADS;
+  }
+
+  sw.cfg = &cfg;
+  sw.points = (unsigned) ((cfg.rpmTo - cfg.rpmFrom) / cfg.rpmStep + 1.5);
+  sw.next = 0;
+  sw.results = calloc((size_t) sw.points * cfg.runs, sizeof(Result));
+  err = malloc(cfg.runs * sizeof(float));
+  if (sw.results == NULL || err == NULL) {
+    fprintf(stderr, "spinsim: out of memory\n");
+    return 1;
+  }
+
+  for (i = 0; i < threads; i++) {
+    pthread_create(&tid[i], NULL, worker, &sw);
+  }
+  for (i = 0; i < threads; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  fps = 1.0 / LinkFramePeriod(cfg.baud, cfg.gapTicks);
+  fpsSide = cfg.tdmaSlot ? cfg.tdmaSlot / (LINK_SIDES * (cfg.tdmaSlot / fps + cfg.tdmaGuard * LINK_TICK_S)) : fps;
+  printf("# baud=%u gap=%u tdma=%u:%u side_frame_rate=%.2f/s fov=+-%.1fdeg ber=%g..%g window=%.2fs runs=%u tol=%.3f\n",
+         cfg.baud, cfg.gapTicks, cfg.tdmaSlot, cfg.tdmaGuard, fpsSide, cfg.halfFov / DEG, cfg.ber0, cfg.berEdge,
+         cfg.window, cfg.runs, cfg.tol);
+  printf("rpm,frames_per_face,success,dir_ok,rel_err_p50,rel_err_p90,alpha_err_mean_dps2,decoded_frac,collision_frac,"
+         "decoded_per_s,corner_decoded_per_s\n");
+
+  for (p = 0; p < sw.points; p++) {
+    r = &sw.results[(size_t) p * cfg.runs];
+    ok = dirOk = alphaN = 0;
+    frames = decoded = collisions = corner = alphaSum = 0;
+    for (i = 0; i < cfg.runs; i++) {
+      err[i] = r[i].relErr;
+      ok    += r[i].relErr <= cfg.tol && r[i].dirOk;
+      dirOk += r[i].dirOk;
+      frames     += r[i].frames;
+      decoded    += r[i].decoded;
+      collisions += r[i].collisions;
+      corner     += r[i].cornerDecoded;
+      if (!isnan(r[i].alphaErr)) {
+        alphaSum += r[i].alphaErr;
+        alphaN++;
+      }
+    }
+    qsort(err, cfg.runs, sizeof(float), cmpFloat);
+    printf("%.2f,%.2f,%.4f,%.4f,%.5f,%.5f,%.3f,%.4f,%.4f,%.2f,%.2f\n",
+           cfg.rpmFrom + p * cfg.rpmStep,
+           fpsSide / (fabs(cfg.rpmFrom + p * cfg.rpmStep) / 60 * LINK_SIDES),
+           (double) ok / cfg.runs, (double) dirOk / cfg.runs,
+           err[cfg.runs / 2], err[(size_t) (cfg.runs * 0.9)],
+           alphaN ? alphaSum / alphaN : NAN,
+           frames ? decoded / frames : 0, frames ? collisions / frames : 0,
+           decoded / (cfg.runs * cfg.window), corner / (cfg.runs * cfg.window));
+  }
+
+  // Byte stream of the first run, for feeding the ground tools
+  if (outPath) {
+    maxFrames = (size_t) (cfg.window * fps) + 2;
+    double *tBuf = malloc(maxFrames * sizeof(double)), *phiBuf = malloc(maxFrames * sizeof(double));
+    if (tBuf == NULL || phiBuf == NULL || CapOpenWrite(&w, outPath, 0) < 0) {
+      return 1;
+    }
+    simulate(&cfg, cfg.rpmFrom, cfg.seed * 0x100000001B3ULL, tBuf, phiBuf, &w);
+    free(tBuf);
+    free(phiBuf);
+    if (CapClose(&w) < 0) {
+      return 1;
+    }
+  }
+
+  free(sw.results);
+  free(err);
+  return 0;
+}
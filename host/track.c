@@ -0,0 +1,213 @@
+/**
+* @file track.c
+*
+* @brief Tracks several spacecraft sharing one ground-station receiver stream
+*
+* Usage:
+*   track -r <registry> [-b baud] [-q] <input>
+*     -r file     Craft registry (see craft.c)
+*     -b baud     Receiver baud rate (default 2400)
+*     -q          Only print the summary
+*
+*   The input is a capture file (*.cap) replayed with its recorded times, a serial device,
+*   pty or FIFO read live, or a raw byte file. Every craft sends one frame per period, so a
+*   stream carrying k craft brings k bytes per period; each craft is dated on its own grid.
+*   A raw byte is one frame period after the last byte of its craft. Live batches are split
+*   by craft, and each part is dated by that craft's latency compensation (latcomp.c).
+*   Bytes of no registered craft take their batch's arrival, or the time of the byte before.
+*
+* Every byte is attributed to its craft and side through the registry's lookup table.
+* The craft's state machine is then advanced (CraftDecode()). One line is printed per face
+* transition with the craft's current spin rate, and a summary per craft at the end.
+*
+* Build: cc -O2 -o track track.c craft.c latcomp.c capture.c link.c -lm
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>               // Req'd because we catch SIGINT
+#include <unistd.h>               // Req'd because we call getopt() and read()
+#include <fcntl.h>                // Req'd because we call open()
+#include <termios.h>              // Req'd because we call cfsetspeed()
+#include <time.h>                 // Req'd because we call clock_gettime()
+#include <sys/stat.h>             // Req'd because we call fstat()
+
+#include "capture.h"              // Req'd because we call CapBlock()
+#include "craft.h"                // Req'd because we call CraftDecode()
+#include "latcomp.h"              // Req'd because we call LatCompBatch()
+
+#define READ_BUFFER_SIZE      512
+
+static CraftRegistry reg;
+static CraftDecoder dec;
+static int quiet = 0;
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal ( int sig )
+{
+  (void) sig;
+  stop = 1;
+}
+
+/**
+feed()
+
+Decodes one byte and reports face transitions.
+*/
+static void feed ( int64_t t_us, unsigned char ch )
+{
+  unsigned c;
+  int transition;
+  const CraftState *st;
+
+  c = CraftDecode(&dec, t_us, ch, &transition);
+  if (transition && !quiet) {
+    st = &dec.st[c];
+    printf("%.6f %-16s side %c  %8.2f rpm\n", t_us / 1e6, reg.craft[c].name,
+           reg.craft[c].chars[st->side], st->rpm);
+  }
+}
+
+/**
+replay()
+
+Feeds the records of a capture file.
+*/
+static int replay ( const char *path )
+{
+  CapReader rd;
+  const CapRecord *r;
+  uint32_t i, n;
+  size_t b;
+
+  if (CapOpenRead(&rd, path) < 0) {
+    return -1;
+  }
+  for (b = 0; b < rd.blocks && !stop; b++) {
+    r = CapBlock(&rd, b, &n);
+    for (i = 0; i < n; i++) {
+      feed(r[i].t_us, r[i].ch);
+    }
+  }
+  CapCloseRead(&rd);
+  return 0;
+}
+
+/**
+stream()
+
+Feeds a live device or a raw byte file.
+*/
+static int stream ( const char *path, unsigned baud )
+{
+  static LatComp lc[CRAFT_MAX];               // Live: batch timing per craft
+  static int64_t tRaw[CRAFT_MAX];             // Raw: time of each craft's next byte
+  unsigned char buf[READ_BUFFER_SIZE];
+  int64_t tb[READ_BUFFER_SIZE], tc[READ_BUFFER_SIZE];
+  int64_t period = (int64_t) (LinkFramePeriod(baud, LINK_GAP_TICKS) * 1e6), t = 0, start;
+  unsigned count[CRAFT_MAX], c, j;
+  struct termios tio;
+  struct timespec ts;
+  struct stat st;
+  ssize_t n, k;
+  int fd, live;
+
+  if ((fd = open(path, O_RDONLY | O_NOCTTY)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    return -1;
+  }
+  live = !S_ISREG(st.st_mode);
+  if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetspeed(&tio, baud == 1200 ? B1200 : baud == 4800 ? B4800 : B2400);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  for (c = 0; c < reg.count; c++) {
+    LatCompInit(&lc[c], period, LATCOMP_DEFAULT_MAX_LATENCY_US);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  start = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+  while (!stop && (n = read(fd, buf, sizeof(buf))) > 0) {
+    if (live) {
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      t = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - start;
+      memset(count, 0, sizeof(count));
+      for (k = 0; k < n; k++) {
+        tb[k] = t;
+        if ((c = reg.lut[buf[k]].craft) < reg.count) {
+          count[c]++;
+        }
+      }
+      for (c = 0; c < reg.count; c++) {
+        if (count[c]) {
+          LatCompBatch(&lc[c], t, count[c], tc);
+          for (k = 0, j = 0; k < n; k++) {
+            if (reg.lut[buf[k]].craft == c) {
+              tb[k] = tc[j++];
+            }
+          }
+        }
+      }
+    } else {
+      for (k = 0; k < n; k++) {
+        if ((c = reg.lut[buf[k]].craft) < reg.count) {
+          t = tRaw[c];
+          tRaw[c] += period;
+        }
+        tb[k] = t;
+      }
+    }
+    for (k = 0; k < n; k++) {
+      feed(tb[k], buf[k]);
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+int main ( int argc, char **argv )
+{
+  const char *regPath = NULL, *in;
+  unsigned baud = linkBaud[LINK_DEFAULT_BAUD], c;
+  size_t len;
+  int opt, rc, usage = 0;
+
+  while ((opt = getopt(argc, argv, "r:b:q")) != -1) {
+    switch (opt) {
+      case 'r': regPath = optarg; break;
+      case 'b': baud = (unsigned) atoi(optarg); break;
+      case 'q': quiet = 1; break;
+      default:  usage = 1; break;
+    }
+  }
+  if (usage || regPath == NULL || optind != argc - 1 || baud == 0) {
+    fprintf(stderr, "usage: track -r <registry> [-b baud] [-q] <input>\n");
+    return 2;
+  }
+
+  CraftRegistryInit(&reg);
+  if (CraftRegistryLoad(&reg, regPath) <= 0) {
+    fprintf(stderr, "%s: no crafts registered\n", regPath);
+    return 1;
+  }
+  CraftDecoderInit(&dec, &reg);
+  signal(SIGINT, onSignal);
+
+  in = argv[optind];
+  len = strlen(in);
+  rc = len > 4 && strcmp(in + len - 4, ".cap") == 0 ? replay(in) : stream(in, baud);
+  if (rc < 0) {
+    return 1;
+  }
+
+  printf("# craft             frames  transitions       rpm\n");
+  for (c = 0; c < reg.count; c++) {
+    printf("  %-16s %8u %12u %9.2f\n", reg.craft[c].name, dec.st[c].frames,
+           dec.st[c].transitions, dec.st[c].rpm);
+  }
+  printf("# %lu bytes from no registered craft, %lu ambiguous\n", dec.unknown, dec.ambiguous);
+  return 0;
+}
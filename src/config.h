@@ -23,13 +23,32 @@
                                                       //  on error
 
 // size of buffers in use
-#define RX0_BUFF_SIZE                     256         // Not used
-#define TX0_BUFF_SIZE                     256         // Not used
-#define RX1_BUFF_SIZE                     256         // 
-#define TX1_BUFF_SIZE                     256         // 
+// UART1 TX must take the longest message: 1 + TICKS_BUFFER_SIZE + POOL_BLOCK_SIZE - 1 +
+//  sizeof(CRLF) = 114 bytes; beyond that a larger buffer only saves MsgTS() some waiting.
+// UART1 RX must take a command line (UI_LINE_SIZE) typed or pasted before TaskUI() runs.
+// 'm' in UI reports the peak fill of the UART1 buffers; shrink them only to measured peaks.
+#define RX0_BUFF_SIZE                     4           // Not used; UART0 is open, so not 0
+#define TX0_BUFF_SIZE                     4           // Only main()'s "\r\n"
+#define RX1_BUFF_SIZE                     64          // 
+#define TX1_BUFF_SIZE                     128         // 
 #define RX4_BUFF_SIZE                     0           // Not used
 #define TX4_BUFF_SIZE                     0           // Not used
 
+// RAM, as RAM_Start_Address and RAM_Size in the .map. crt0 sets the stack pointer to the
+// end of RAM, and the stack grows down towards the end of UDATA0.
+#define RAM_END                           0x3900
+
+// Message buffer pool (pool.c)
+#define POOL_BLOCKS                       3
+#define POOL_BLOCK_SIZE                   96
+
+// Spacecraft identity
+// Every unit flying at the same time needs its own side characters, listed under the same
+// name in the ground station's craft registry (host/craft.c). host/codebook finds sets that
+// stay far apart in Hamming distance.
+#define CRAFT_NAME                        "LMRST-Sat"
+#define SIDE_CHARS                        { 'x', 'c', 'V', 'M' }   // P5.0, P5.1, P5.2, P5.3
+
 
 #endif /* __CONFIG_H */
 
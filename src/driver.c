@@ -13,6 +13,8 @@
 * P5.6 --> 1,1,1,1,1,1,1,1,1,1
 * P5.7 --> 0,0,0,0,0,0,0,0,0,1
 *
+* @note The characters are set per spacecraft by SIDE_CHARS in config.h, and LEDarray is rebuilt from
+*       them at startup. The values below are those of the default set.
 * @note ASCII chosen such that there are at least three bits different between the binay forms of any two characters.
 *       'x' 0111 1000
 *       'c' 0110 0011
@@ -21,16 +23,21 @@
 */
 
 #include <msp430.h>               // Req'd because we refer to P5OUT
-#include <salvo.h>                // Req'd because we call OSDelay() 
+#include <salvo.h>                // Req'd because we call OSDelay() and OSGetTicks()
 
+#include "config.h"               // Req'd because we use SIDE_CHARS and CRAFT_NAME
 #include "driver.h"               // Good to self-reference
 #include "main.h"                 // Application header
-#include "msg.h"                  // Req'd because we call MsgTS()
-#include "signal.h"               // Req'd because we call baudControl()
-#include "counter.h"              // Req'd because we call counter()
+#include "msg.h"                  // Req'd because we call MsgTS() and MsgNow()
+#include "pool.h"                 // Req'd because we call PoolGet()
+#include "signal.h"               // Req'd because we call baudControl() and ledAccount()
+#include "counter.h"              // Req'd because we call counter() and returnCount()
+
+// Character transmitted by each side, P5.0 first.
+const unsigned char sideChars[SIDES] = SIDE_CHARS;
 
 //10 elements made up of start, stop and 8 bits.
-char LEDarray[START_BITS+DATA_BITS+STOP_BITS] = {   
+char LEDarray[FRAME_BITS] = {   
 0xFF,
 0x40,
 0x5F,
@@ -43,6 +50,228 @@ char LEDarray[START_BITS+DATA_BITS+STOP_BITS] = {
 0x40
 };
 
+// Ticks between frames
+static unsigned char gapTicks = GAP_TICKS;
+
+// Trace mode state
+static unsigned char traceMode = 0;
+
+// TDMA mode state
+static unsigned char tdmaMode = 0;
+static unsigned char tdmaSlotFrames = TDMA_SLOT_FRAMES;   // Frames per slot
+static unsigned char tdmaGuard = TDMA_GUARD_TICKS;        // Guard ticks after each slot
+static unsigned char tdmaSlot;                  // Side whose slot is current
+static unsigned char tdmaFrames;                // Frames sent in the current slot
+static unsigned int superframe;                 // Superframe sequence number
+
+// PRBS test mode state
+static unsigned char prbsMode = 0;
+static const unsigned char prbsPoly[SIDES] = { PRBS_POLY_0, PRBS_POLY_1, PRBS_POLY_2, PRBS_POLY_3 };
+static unsigned char prbsState[SIDES];
+static char prbsFrame[FRAME_BITS];
+
+/**
+buildFrame()
+
+Transposes one character per side into the layout of LEDarray.
+frame[FRAME_BITS-1] is sent first and holds the start bits, frame[0] holds the stop bits,
+and bit n of every element belongs to side n.
+P5 bits above the sides are copied from LEDarray so the unused outputs behave as before.
+
+@param  frame is the FRAME_BITS array to fill.
+@param  chars holds the character of each side.
+*/
+static void buildFrame ( char *frame, const unsigned char *chars )
+{
+  unsigned int i, s;
+
+  for (i = 0; i < FRAME_BITS; i++) {
+    frame[i] = LEDarray[i] & ~SIDE_MASK;
+  }
+  for (s = 0; s < SIDES; s++) {
+    for (i = 0; i < DATA_BITS; i++) {
+      if (chars[s] & (1 << i)) {
+        frame[FRAME_BITS-1-START_BITS-i] |= 1 << s;
+      }
+    }
+    for (i = 0; i < STOP_BITS; i++) {
+      frame[i] |= 1 << s;
+    }
+  }
+}
+
+/**
+prbsNext()
+
+Steps the LFSRs of the given sides by 8 bits and rebuilds prbsFrame from the new states.
+Called between frames, while interrupts are enabled. In TDMA mode only the side that has
+just transmitted is stepped, so every side's received bytes stay successive LFSR states,
+as bertest predicts them.
+
+@param  sides holds one bit per side to step.
+*/
+static void prbsNext ( unsigned char sides )
+{
+  unsigned int s, k, state;
+
+  for (s = 0; s < SIDES; s++) {
+    if (!(sides & (1 << s))) {
+      continue;
+    }
+    state = prbsState[s];
+    for (k = 0; k < 8; k++) {
+      state <<= 1;
+      if (state & 0x100) {
+        state ^= 0x100 | prbsPoly[s];
+      }
+    }
+    prbsState[s] = state;
+  }
+  buildFrame(prbsFrame, prbsState);
+}
+
+
+/**
+togglePRBS()
+
+Switches between the fixed LEDarray characters and PRBS test frames, when the user
+presses 'p' in UI. Every side's LFSR restarts from 0x01.
+*/
+void togglePRBS ( void )
+{
+  unsigned int s;
+
+  prbsMode ^= 1;
+  if (prbsMode) {
+    for (s = 0; s < SIDES; s++) {
+      prbsState[s] = 0x01;
+    }
+    prbsNext(SIDE_MASK);
+    MsgTS("  " STR_TASK_DRIVER "PRBS test frames on.");
+  } else {
+    MsgTS("  " STR_TASK_DRIVER "PRBS test frames off.");
+  }
+}
+
+
+/**
+toggleTrace()
+
+Switches trace reports on and off, when the user presses 'e' in UI.
+*/
+void toggleTrace ( void )
+{
+  traceMode ^= 1;
+  if (traceMode) {
+    MsgTS("  " STR_TASK_DRIVER "Trace reports on.");
+  } else {
+    MsgTS("  " STR_TASK_DRIVER "Trace reports off.");
+  }
+}
+
+
+/**
+toggleTDMA()
+
+Switches between all sides transmitting together and TDMA slots, when the user presses
+'t' in UI. A new schedule starts with side 0 and superframe 0. Reports the frame rate
+each side gets and the superframe rate.
+*/
+void toggleTDMA ( void )
+{
+  unsigned int sfRate, sideRate, sfTicks;
+
+  tdmaMode ^= 1;
+  if (tdmaMode) {
+    tdmaSlot = 0;
+    tdmaFrames = 0;
+    superframe = 0;
+    MsgTSf("  " STR_TASK_DRIVER "TDMA on: %u frame(s) per slot, %u guard tick(s).",
+            tdmaSlotFrames, tdmaGuard);
+    // Rates in hundredths per second; one tick is 10 ms
+    sfTicks  = TDMA_SUPER_TICKS(tdmaSlotFrames, gapTicks, tdmaGuard);
+    sfRate   = (unsigned int) (10000UL/sfTicks);
+    sideRate = (unsigned int) (10000UL*tdmaSlotFrames/sfTicks);
+    MsgTSf("  " STR_TASK_DRIVER "Superframe %u ms, %u.%02u/s; %u.%02u frames/s per side.",
+            sfTicks*10, sfRate/100, sfRate%100, sideRate/100, sideRate%100);
+  } else {
+    sideRate = 10000/gapTicks;
+    MsgTSf("  " STR_TASK_DRIVER "TDMA off: %u.%02u frames/s per side.", sideRate/100, sideRate%100);
+  }
+}
+
+
+/**
+setGap()
+
+Sets the number of ticks from one frame to the next, for "gap N" in UI.
+Takes effect after the frame being sent.
+
+@param  ticks is the new gap, 1 to GAP_TICKS_MAX.
+@return 0, or -1 if ticks is out of range.
+*/
+int setGap ( unsigned int ticks )
+{
+  if (ticks < 1 || ticks > GAP_TICKS_MAX) {
+    return -1;
+  }
+  gapTicks = ticks;
+  return 0;
+}
+
+
+/**
+setSlot()
+
+Sets the number of frames in each TDMA slot, for "slot N" in UI. Takes effect after the
+frame being sent; a slot already longer than N ends there.
+
+@param  frames is the new slot length, 1 to TDMA_SLOT_FRAMES_MAX.
+@return 0, or -1 if frames is out of range.
+*/
+int setSlot ( unsigned int frames )
+{
+  if (frames < 1 || frames > TDMA_SLOT_FRAMES_MAX) {
+    return -1;
+  }
+  tdmaSlotFrames = frames;
+  return 0;
+}
+
+
+/**
+setGuard()
+
+Sets the number of silent ticks after each TDMA slot, for "guard N" in UI.
+Takes effect at the end of the current slot.
+
+@param  ticks is the new guard time, 0 to TDMA_GUARD_TICKS_MAX.
+@return 0, or -1 if ticks is out of range.
+*/
+int setGuard ( unsigned int ticks )
+{
+  if (ticks > TDMA_GUARD_TICKS_MAX) {
+    return -1;
+  }
+  tdmaGuard = ticks;
+  return 0;
+}
+
+
+/**
+driverStatus()
+
+Appends the transmitter settings to a "status" line in UI: gap, PRBS, trace and TDMA
+modes, the TDMA slot length and guard time, and the superframe number.
+
+@param  s is the end of the line being built.
+*/
+void driverStatus ( char *s )
+{
+  sprintf(s, " gap=%u p=%u e=%u t=%u slot=%u guard=%u sf=%u", gapTicks, prbsMode, traceMode,
+          tdmaMode, tdmaSlotFrames, tdmaGuard, superframe);
+}
+
 
 /**
 TaskDriver()
@@ -52,15 +281,31 @@ TaskDriver()
 Loops through the LEDarray to emit every hex. All ASCII signals sent to P5.
 baudControl() is used to alter the baud rate of ASCII signal transmission.
 While baudControl() is working, all P5 signals maintain their state.
+ledAccount() then adds the frame's LED on-time to the telemetry.
 
 This application allows ASCII transmission at 1200, 2400 and 4800 bps.
 
+In PRBS test mode (see togglePRBS()) prbsFrame is sent instead of LEDarray, and the
+next PRBS frame is prepared after each transmission for the sides that were not idle.
+
+In trace mode (see toggleTrace()) every TRACE_INTERVAL-th frame is reported with the
+tick it started on, as "Trace: frame <count> tick <tick>", both modulo 65536. In TDMA mode
+the report goes on with " sf <superframe> slot <side>". The report is printed right after
+the frame if the transmit buffer has room (MsgNow()), as the ground dates the frame by its
+arrival; otherwise it is queued for TaskPeriodic() rather than waited for.
+
+In TDMA mode (see toggleTDMA()) only the current slot's side transmits; the other sides'
+lanes are ORed to idle, so no two faces' frames overlap at a corner. The slot ends after
+tdmaSlotFrames frames with a longer OS_Delay() covering the guard ticks.
+
 counter() called after every loop to increment number of transmitted signal blocks by 1.
-OS_Delay() is called after every loop to separate signal blocks.
+OS_Delay() is called after every loop to separate signal blocks, for gapTicks ticks
+(see setGap()).
 During OS_Delay(), neither the ASCII signals nor the carrier waves are being transmitted.
 This avoids the receiver getting confused with overlapping signals.
 
-If application works correctly, then receiving end should receive:
+If application works correctly, then receiving end should receive sideChars[n] from P5.n;
+with the default SIDE_CHARS:
   P5.0: 'x'
   P5.1: 'c'
   P5.2: 'V'
@@ -73,25 +318,64 @@ void TaskDriver ( void )
 {
   static unsigned int i = 0;
   static unsigned s;
+  static char *frame;
+  static OStypeTick tick;
+  static unsigned char idle, lanes;
+  static char *msg;
+
+  // Transmit this spacecraft's characters
+  buildFrame(LEDarray, sideChars);
+  initCarrier();
 
   // Startup message
   MsgTS(STR_TASK_DRIVER "Starting.");
   MsgTS("  Communicating at " DEFAULT_BAUDRATE " bps.");       // Note indent of two spaces
+  MsgTSf("  " CRAFT_NAME " sides: '%c' '%c' '%c' '%c'.", sideChars[0], sideChars[1], sideChars[2], sideChars[3]);
 
   // This loop runs infinitely, and alters between a transmitting state and an idle state.
   while(1) {
-    i = START_BITS+DATA_BITS+STOP_BITS-1;
+    i = FRAME_BITS-1;
+    frame = prbsMode ? prbsFrame : LEDarray;
+    idle = tdmaMode ? SIDE_MASK & ~(1 << tdmaSlot) : 0;
     s = __disable_interrupt();
+    tick = OSGetTicks();
 
       // Signal loop, transmitting state
       do {
-        P5OUT = LEDarray[i];
-        baudControl();
+        lanes = frame[i] | idle;
+        P5OUT = lanes;
+        baudControl(lanes);
       } while (i--);
     counter();
 
     __set_interrupt(s);
-    OS_Delay(1);
+
+    ledAccount(frame, idle);
+
+    // Trace reports go out at once when they fit, and the frame schedule never waits for the console
+    if (traceMode && returnCount() % TRACE_INTERVAL == 0 && (msg = PoolGet(POOL_OWNER_DRIVER))) {
+      if (tdmaMode) {
+        sprintf(msg, STR_TASK_DRIVER STR_TRACE "%u tick %u sf %u slot %u", returnCount(), (unsigned int) tick, superframe, tdmaSlot);
+      } else {
+        sprintf(msg, STR_TASK_DRIVER STR_TRACE "%u tick %u", returnCount(), (unsigned int) tick);
+      }
+      MsgNow(msg);
+    }
+    if (prbsMode) {
+      prbsNext(SIDE_MASK & ~idle);
+    }
+
+    // Last frame of a TDMA slot: hand over to the next side after the guard time
+    if (tdmaMode && ++tdmaFrames >= tdmaSlotFrames) {
+      tdmaFrames = 0;
+      if (++tdmaSlot == SIDES) {
+        tdmaSlot = 0;
+        superframe++;
+      }
+      OS_Delay(gapTicks+tdmaGuard);
+    } else {
+      OS_Delay(gapTicks);
+    }
    }
  }
 
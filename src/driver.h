@@ -10,6 +10,14 @@
 #define __DRIVER_H
 
 extern void TaskDriver ( void );
+extern void togglePRBS ( void );
+extern void toggleTrace ( void );
+extern void toggleTDMA ( void );
+extern int setGap ( unsigned int ticks );
+extern int setSlot ( unsigned int frames );
+extern int setGuard ( unsigned int ticks );
+extern void driverStatus ( char *s );
+extern const unsigned char sideChars[];
 
 #define STR_TASK_DRIVER     "TaskDriver:\t"
 
@@ -19,6 +27,41 @@ extern void TaskDriver ( void );
 #define DATA_BITS           8
 #define START_BITS          1
 #define STOP_BITS           1
+#define FRAME_BITS          (START_BITS+DATA_BITS+STOP_BITS)
+
+// Inter-frame gap: OS_Delay() ticks from the start of one frame to the next, set by
+// "gap N" in UI. Keep the default in step with LINK_GAP_TICKS in host/link.h.
+#define GAP_TICKS           1
+#define GAP_TICKS_MAX       100
+
+// Number of lateral faces, one per P5 bit starting at P5.0
+#define SIDES               4
+#define SIDE_MASK           ((1<<SIDES)-1)
+
+// PRBS test mode: each side sends successive states of its own 8-bit Galois LFSR,
+// stepped 8 times per frame. Every polynomial is primitive, so each side repeats
+// after 255 frames, and the ground can predict the next byte from the previous one.
+// Keep in step with host/link.c.
+#define PRBS_POLY_0         0x1D    // x^8+x^4+x^3+x^2+1
+#define PRBS_POLY_1         0x2B    // x^8+x^5+x^3+x+1
+#define PRBS_POLY_2         0x5F    // x^8+x^6+x^4+x^3+x^2+x+1
+#define PRBS_POLY_3         0x63    // x^8+x^6+x^5+x+1
+
+// Trace mode: every TRACE_INTERVAL frames, the frame's number (counter()) and the Salvo
+// tick it started on are reported, so the ground can tie received bytes to their emission.
+#define TRACE_INTERVAL      64
+#define STR_TRACE           "Trace: frame "
+
+// TDMA mode: the sides take turns in a superframe of SIDES slots, P5.0 first. A slot is
+// a number of frames of its own side, the other sides' lanes held idle (1), and is
+// followed by a number of guard ticks of silence. Every frame takes one gap. Both are set
+// by "slot N" and "guard N" in UI; keep the defaults in step with LINK_TDMA_SLOT_FRAMES
+// and LINK_TDMA_GUARD_TICKS in host/link.h. The limits keep OS_Delay() below 256 ticks.
+#define TDMA_SLOT_FRAMES      1
+#define TDMA_SLOT_FRAMES_MAX  100
+#define TDMA_GUARD_TICKS      1
+#define TDMA_GUARD_TICKS_MAX  100
+#define TDMA_SUPER_TICKS(frames, gap, guard)  (SIDES*((frames)*(gap)+(guard)))
 
 
 #endif /* __DRIVER_H */
@@ -14,6 +14,7 @@
 
 #include "isr.h"                  // Good to self-reference
 #include "main.h"                 // Application header
+#include "pool.h"                 // Req'd because we count rx1Level
 
 /**
 Timer_A()
@@ -48,12 +49,12 @@ ISRRx0()
 @brief UART1 Receiving Interrupt Service Routine
 
 Pumpkin usart libraries are used to put characters received at the serial interface into a buffer.
-The semaphore SEM_UI_CHAR_P is signaled. 
-TaskUI() is waiting for that semaphore and processes the command in the buffer.
+The binary semaphore SEM_UI_CHAR_P is signaled; signals while it is already set are lost,
+which is intended: TaskUI() waits for it and then processes everything in the buffer.
 */
 void ISRRx0 (void) __interrupt[UART0RX_VECTOR] {
   usart_uart0_inchar(RXBUF0);
-  OSSignalSem(SEM_UI_CHAR_P); 
+  OSSignalBinSem(SEM_UI_CHAR_P); 
 }
 
 
@@ -75,12 +76,15 @@ ISRRx1()
 @brief UART1 Receiving Interrupt Service Routine
 
 Pumpkin usart libraries are used to put characters received at the serial interface into a buffer.
-The semaphore SEM_UI_CHAR_P is signaled. 
-TaskUI() is waiting for that semaphore and processes the command in the buffer.
+The binary semaphore SEM_UI_CHAR_P is signaled; signals while it is already set are lost,
+which is intended: TaskUI() waits for it and then processes everything in the buffer.
 */
 void ISRRx1 (void) __interrupt[UART1RX_VECTOR] {
   usart_uart1_inchar(RXBUF1);
-  OSSignalSem(SEM_UI_CHAR_P); 
+  if (++rx1Level > rx1High) {                   // High-water mark for 'm' in UI
+    rx1High = rx1Level;
+  }
+  OSSignalBinSem(SEM_UI_CHAR_P); 
 }
 
 
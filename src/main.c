@@ -18,13 +18,13 @@
 #include "driver.h"               // Req'd because we reference TaskDriver()
 #include "ui.h"                   // Req'd because we reference TaskUI()
 #include "periodic.h"             // Req'd because we reference TaskPeriodic()
-
-// General-purpose buffer for creating long strings
-char strTmp[256];
+#include "pool.h"                 // Req'd because we call PoolPaintStack()
 
 /**
 main()
 
+Watchdog stopped, so that it cannot expire while the stack is painted.
+Stack painted through PoolPaintStack() function.
 Hardware initialized through Init() function.
 RTOS initialized through OSinit() function.
 Tasks and events created.
@@ -32,6 +32,12 @@ Salvos scheduler run in an infinite loop.
 */
 void main(void) {
 
+  // Stop the watchdog first: painting ~8.8KB of stack outlasts its 32768-cycle timeout.
+  WDT_OFF;
+
+  // Mark the stack for its high-water mark (see PoolReport()).
+  PoolPaintStack();
+
   // Initialize MSP430 built-in peripherals and pin configuration.
   Init(); 
 
@@ -53,7 +59,7 @@ void main(void) {
   /*
   Creating all events.
   */
-  OSCreateSem(SEM_UI_CHAR_P, 0);
+  OSCreateBinSem(SEM_UI_CHAR_P, 0);         // Binary: a burst of characters is one wake
   
   // Since ISRs are present, interrupts need to enabled globally.
   __enable_interrupt();
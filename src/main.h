@@ -12,8 +12,6 @@
 #ifndef __MAIN_H
 #define __MAIN_H
 
-extern char strTmp[];
-
 // Application wide constants
 // Version information
 #define VERSION_NUM                     "3.0"
@@ -3,15 +3,26 @@
 *
 * @brief Defines MsgTS() to prints a tagged message for UI purposes
 *
+* MsgTSf() formats a message in a pool block (see pool.c) and prints it. Tasks that must
+* not wait for room in the transmit buffer hand their formatted block to MsgNow(), which
+* prints it at once if it fits, or to MsgPost(); TaskPeriodic() prints the queue with
+* MsgFlush().
+*
 * @note Only one of the two initialized UARTs - UART1 - has been configured here for communication.
 */
 
 #include <salvo.h>                // Req'd because we call OSGetTicks()
 #include <usart_uart.h>           // Req'd because we call usart_uart1_puts()
+#include <stdarg.h>               // Req'd because MsgTSf() takes variable arguments
 
 #include "config.h"               // Req'd because we use TX1_BUFF_SIZE
 #include "msg.h"                  // Good to self-reference
 #include "main.h"                 // Application header
+#include "pool.h"                 // Req'd because we call PoolGet() and PoolPut()
+
+// Messages posted for TaskPeriodic(), oldest at msgHead
+static char *msgQueue[POOL_BLOCKS];
+static unsigned char msgHead, msgCount;
 
 /**
 MsgTS()
@@ -32,7 +43,7 @@ Includes Task Identifier and Message.
 void MsgTS(const char * cP)
 {
   unsigned int size;
-  char strTicks[TICKS_BUFFER_SIZE];
+  static char strTicks[TICKS_BUFFER_SIZE];      // Static: kept off the shared stack
   
   OStypeTick a = 0;
   unsigned long t_ms = 0, t_s = 0;
@@ -62,7 +73,102 @@ void MsgTS(const char * cP)
     usart_uart1_puts(strTicks);
     usart_uart1_puts(cP);
     usart_uart1_puts(CRLF);
+    PoolNoteTx1(TX1_BUFF_SIZE - usart_uart1_tx_free());
   } 
 }
 
 
+/**
+MsgTSf()
+
+Formats a message in a pool block and prints it with MsgTS().
+The message is dropped if no block is free (counted in PoolReport()); the pool keeps
+one block for POOL_OWNER_MSG, so this happens only if a caller holds one already.
+
+@param  fmt is a printf() format; the message must fit in POOL_BLOCK_SIZE.
+*/
+void MsgTSf(const char * fmt, ...)
+{
+  va_list ap;
+  char *s;
+
+  if ((s = PoolGet(POOL_OWNER_MSG)) == 0) {
+    return;
+  }
+  va_start(ap, fmt);
+  vsnprintf(s, POOL_BLOCK_SIZE, fmt, ap);
+  va_end(ap);
+  MsgTS(s);
+  PoolPut(s);
+}
+
+
+/**
+fits()
+
+@return Nonzero if the message fits in the transmit buffer now, so MsgTS() will not wait.
+*/
+static int fits(const char * s)
+{
+  return usart_uart1_tx_free() >= 1 + TICKS_BUFFER_SIZE + strlen(s) + sizeof(CRLF);
+}
+
+
+/**
+MsgNow()
+
+Prints a formatted pool block at once and returns it to the pool, if nothing is queued
+before it and it fits in the transmit buffer without waiting; otherwise queues it with
+MsgPost(). For reports whose timing matters, e.g. trace reports.
+*/
+void MsgNow(char * block)
+{
+  if (msgCount == 0 && fits(block)) {
+    MsgTS(block);
+    PoolPut(block);
+    return;
+  }
+  MsgPost(block);
+}
+
+
+/**
+MsgPost()
+
+Queues a formatted pool block for TaskPeriodic() to print, which then owns it.
+The block is dropped, and counted, if the queue is full.
+*/
+void MsgPost(char * block)
+{
+  if (msgCount == POOL_BLOCKS) {
+    PoolDrop(block);
+    return;
+  }
+  PoolGive(block, POOL_OWNER_PERIODIC);
+  msgQueue[(msgHead + msgCount++) % POOL_BLOCKS] = block;
+}
+
+
+/**
+MsgFlush()
+
+Prints queued messages while they fit in the transmit buffer without waiting, and returns
+their blocks to the pool. Called in by TaskPeriodic().
+*/
+void MsgFlush(void)
+{
+  char *s;
+
+  while (msgCount) {
+    s = msgQueue[msgHead];
+    if (!fits(s)) {
+      break;
+    }
+    MsgTS(s);
+    PoolPut(s);
+    msgHead = (msgHead + 1) % POOL_BLOCKS;
+    msgCount--;
+  }
+}
+
+
@@ -10,6 +10,10 @@
 #define __MSG_H
 
 extern void MsgTS(const char *);
+extern void MsgTSf(const char *, ...);
+extern void MsgNow(char *);
+extern void MsgPost(char *);
+extern void MsgFlush(void);
 
 #define CRLF                                "\r\n"
 #define TICKS_BUFFER_SIZE                   15
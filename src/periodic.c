@@ -7,6 +7,8 @@
 * As long as the message keeps on being displayed, we can be sure that the program has not 
 * crashed, and that the transmitter end is sending out signals.
 *
+* Between messages it prints, every FLUSH_TICKS, the messages posted with MsgPost().
+*
 * @note It is assumed that if this task is running right, then all other tasks are running correctly too.
 */
 
@@ -15,17 +17,25 @@
 
 #include "periodic.h"             // Good to self-reference
 #include "main.h"                 // Application header
-#include "msg.h"                  // Req'd because we call MsgTS()
+#include "msg.h"                  // Req'd because we call MsgTS() and MsgFlush()
 
 void TaskPeriodic ( void )     
 {
+  static unsigned int ticks = 0;
+
   // Startup message
   MsgTS(STR_TASK_PERIODIC "Starting.");
 
-   // Begin infinite loop that displays a message periodically.
+   // Begin infinite loop that displays a message periodically,
+   // and prints messages other tasks have posted in between.
     while (1) {
-      MsgTS(STR_TASK_PERIODIC "Transmitting");
-      P1OUT ^= BIT0;
-      OS_Delay(200);                            //waits 2 sec before displaying next message
+      if (ticks == 0) {
+        MsgTS(STR_TASK_PERIODIC "Transmitting");
+        P1OUT ^= BIT0;
+        ticks = PERIODIC_TICKS;                 //waits 2 sec before displaying next message
+      }
+      MsgFlush();
+      OS_Delay(FLUSH_TICKS);
+      ticks -= FLUSH_TICKS;
     }
 }
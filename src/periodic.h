@@ -13,4 +13,7 @@ extern void TaskPeriodic ( void );
 
 #define STR_TASK_PERIODIC     "TaskPeriodic:\t"
 
+#define PERIODIC_TICKS        200           // 'Transmitting' every 2 s
+#define FLUSH_TICKS           10            // Posted messages printed within 100 ms
+
 #endif /* __PERIODIC_H */
@@ -0,0 +1,174 @@
+/**
+* @file pool.c
+*
+* @brief Fixed-block buffer pool for message formatting, and RAM high-water marks
+*
+* Messages are formatted in one of POOL_BLOCKS blocks of POOL_BLOCK_SIZE bytes instead of a
+* global scratch string. A block is held only while its message is built and printed, or
+* while it waits in the message queue, so a few small blocks replace one large buffer.
+* Every block records its owner; a task handing a formatted message to another passes the
+* block on with PoolGive() instead of copying it. Owners other than POOL_OWNER_MSG never get
+* the last free block, so a burst of trace reports cannot starve the replies of TaskUI().
+*
+* The same module keeps the high-water marks reported by 'm' in UI: stack depth (painted at
+* startup), pool blocks in use, the longest message, and the fill of the UART1 buffers.
+*
+* @note POOL_BLOCKS, POOL_BLOCK_SIZE and the UART buffer sizes are set in config.h.
+*/
+
+#include <salvo.h>                // Req'd because we call sprintf()
+
+#include "config.h"               // Req'd because we use POOL_BLOCKS, RAM_END and TX1_BUFF_SIZE
+#include "pool.h"                 // Good to self-reference
+#include "main.h"                 // Application header
+#include "msg.h"                  // Req'd because we call MsgTSf()
+
+// End of the last RAM segment (___end_UDATA0 in the .map); the stack grows down from
+// RAM_END towards it
+extern char __end_UDATA0[];
+#define STACK_BOTTOM          __end_UDATA0
+#define STACK_TOP             ((char *) RAM_END)
+
+static char blocks[POOL_BLOCKS][POOL_BLOCK_SIZE];
+static unsigned char owners[POOL_BLOCKS];
+static unsigned char inUse, inUseHigh;
+static unsigned int longest, dropped;
+static unsigned int tx1High;
+
+volatile unsigned int rx1Level;
+volatile unsigned int rx1High;
+
+/**
+PoolGet()
+
+Takes a free block. The last free block is kept for POOL_OWNER_MSG.
+
+@param  owner is the POOL_OWNER_xxx taking it.
+@return The block, holding an empty string, or 0 if none is free to this owner.
+*/
+char *PoolGet ( unsigned char owner )
+{
+  unsigned int i;
+
+  if (owner != POOL_OWNER_MSG && inUse >= POOL_BLOCKS - 1) {
+    dropped++;
+    return 0;
+  }
+  for (i = 0; i < POOL_BLOCKS; i++) {
+    if (owners[i] == POOL_OWNER_FREE) {
+      owners[i] = owner;
+      if (++inUse > inUseHigh) {
+        inUseHigh = inUse;
+      }
+      blocks[i][0] = '\0';
+      return blocks[i];
+    }
+  }
+  dropped++;
+  return 0;
+}
+
+
+/**
+PoolGive()
+
+Hands a block over to another owner, e.g. from the task that formatted a message to the
+one that prints it.
+*/
+void PoolGive ( char *block, unsigned char owner )
+{
+  owners[(block - blocks[0]) / POOL_BLOCK_SIZE] = owner;
+}
+
+
+/**
+PoolPut()
+
+Returns a block to the pool, noting the length of the string it held.
+*/
+void PoolPut ( char *block )
+{
+  unsigned int i = (block - blocks[0]) / POOL_BLOCK_SIZE, n;
+
+  for (n = 0; n < POOL_BLOCK_SIZE && block[n]; n++);
+  if (n > longest) {
+    longest = n;
+  }
+  owners[i] = POOL_OWNER_FREE;
+  inUse--;
+}
+
+
+/**
+PoolDrop()
+
+Returns a block whose message will not be printed, counting it with the messages that got
+no block.
+*/
+void PoolDrop ( char *block )
+{
+  dropped++;
+  PoolPut(block);
+}
+
+
+/**
+PoolDropped()
+
+@return The number of messages dropped for want of a block or of room in the queue.
+*/
+unsigned int PoolDropped ( void )
+{
+  return dropped;
+}
+
+
+/**
+PoolPaintStack()
+
+Fills the unused part of the stack with STACK_PAINT, so that PoolReport() can find how deep
+it has ever been. Called first thing in main(), once the watchdog is stopped.
+*/
+void PoolPaintStack ( void )
+{
+  char here;
+  char *p;
+
+  for (p = STACK_BOTTOM; p < &here - STACK_PAINT_MARGIN; p++) {
+    *p = STACK_PAINT;
+  }
+}
+
+
+/**
+PoolNoteTx1()
+
+Records the fill of the UART1 transmit buffer. Called in by MsgTS() after each message.
+*/
+void PoolNoteTx1 ( unsigned int level )
+{
+  if (level > tx1High) {
+    tx1High = level;
+  }
+}
+
+
+/**
+PoolReport()
+
+Prints the high-water marks, when the user presses 'm' in UI.
+*/
+void PoolReport ( void )
+{
+  char *p = STACK_BOTTOM;
+
+  while (p < STACK_TOP && *p == (char) STACK_PAINT) {
+    p++;
+  }
+  MsgTSf("  " STR_POOL "Stack %u of %u bytes.", (unsigned int) (STACK_TOP - p),
+         (unsigned int) (STACK_TOP - STACK_BOTTOM));
+  MsgTSf("  " STR_POOL "Blocks %u of %u in use, longest message %u of %u bytes, %u dropped.",
+         inUseHigh, POOL_BLOCKS, longest, POOL_BLOCK_SIZE - 1, dropped);
+  MsgTSf("  " STR_POOL "UART1 TX %u of %u, RX %u of %u bytes.", tx1High, TX1_BUFF_SIZE,
+         rx1High, RX1_BUFF_SIZE);
+}
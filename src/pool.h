@@ -0,0 +1,37 @@
+/**
+* @file pool.h
+*
+* @brief Header file for pool.c
+*
+* Lists functions and variables available to all who include pool.h
+*/
+
+#ifndef __POOL_H
+#define __POOL_H
+
+extern char *PoolGet ( unsigned char owner );
+extern void PoolGive ( char *block, unsigned char owner );
+extern void PoolPut ( char *block );
+extern void PoolDrop ( char *block );
+extern unsigned int PoolDropped ( void );
+extern void PoolPaintStack ( void );
+extern void PoolNoteTx1 ( unsigned int level );
+extern void PoolReport ( void );
+
+// Bytes waiting in the UART1 receive buffer: counted up in ISRRx1(), down in TaskUI()
+extern volatile unsigned int rx1Level;
+extern volatile unsigned int rx1High;
+
+#define STR_POOL              "Pool:\t"
+
+// Block owners
+#define POOL_OWNER_FREE       0
+#define POOL_OWNER_MSG        1             // Being formatted and printed by MsgTSf()
+#define POOL_OWNER_DRIVER     2             // Being formatted by TaskDriver()
+#define POOL_OWNER_PERIODIC   3             // Queued for TaskPeriodic() to print
+
+// Stack painting: untouched bytes keep this value
+#define STACK_PAINT           0xA5
+#define STACK_PAINT_MARGIN    16            // Bytes below the caller's frame left unpainted
+
+#endif /* __POOL_H */
@@ -15,6 +15,10 @@
 *            |_                             _|
 *
 * @note Carrier wave is transmitted only during the interval that ASCII signals are being transmitted
+* @note Each side's carrier duty cycle can be lowered from 50% (see setDuty(); needs
+*       CARRIER_SHAPING, off until PHASE_CYCLES is measured) to trade link margin for LED
+*       power, and the carrier pins of lanes at a mark can be held low (see toggleSuppress()).
+*       ledReport() estimates the resulting LED on-time.
 * @note Since 'cycles' is an integer, baud rate cannot go beyond 38400Hz.
 *      In fact, since 38.4 kHz is the carrier wave frequency, it was empirically found 
 *      that any ASCII transmission frequency beyond 4800 Hz clashes with the carrier 
@@ -28,11 +32,31 @@
 #include "signal.h"                // Good to self-reference
 #include "main.h"                  // Application header
 #include "msg.h"                   // Req'd because we call MsgTS()
+#include "driver.h"                // Req'd because we use SIDES and sideChars[]
 
 static unsigned int arrayCounter = 1;     // Default value corresponds to 2400 bps
 static unsigned int cycles = 31;          //  "  
 static unsigned int delay;
 
+// Carrier shaping state
+static unsigned char dutyPhases[SIDES];             // Carrier-on phases of each side
+static unsigned char shaped = 0;                    // Some side is not at 50%
+static unsigned char suppress = 0;                  // Idle lanes get no carrier
+#if CARRIER_SHAPING
+static unsigned char carrierPattern[CARRIER_PHASES]; // P2OUT for each phase
+
+static void shapedCarrier( unsigned char pins );
+#endif
+
+// LED on-time since the last ledReport(), in carrier phases
+static unsigned long ledOnPhases[SIDES];
+static OStypeTick ledSince;
+
+// Carrier pin(s) of each combination of sides: P5.0->P2.3, P5.1->P2.1, P5.2->P2.7, P5.3->P2.5
+static const unsigned char lanePins[1<<SIDES] = {
+  0x00, 0x08, 0x02, 0x0A, 0x80, 0x88, 0x82, 0x8A, 0x20, 0x28, 0x22, 0x2A, 0xA0, 0xA8, 0xA2, 0xAA
+};
+
 // Contains different baud rates and the respective number of NOP cycles required to attain them.
 int baud[3][2] ={
 					63,                         // Value of 'cycles' required to achieve 1200 bps
@@ -58,8 +82,7 @@ void increaseBaud(void)
     if(arrayCounter<2){
     arrayCounter++;
     cycles = baud[arrayCounter][0];
-            sprintf(strTmp, "  " STR_BAUD_CONTROL "Baud rate increased to %i bps.", baud[arrayCounter][1]);
-            MsgTS(strTmp);
+            MsgTSf("  " STR_BAUD_CONTROL "Baud rate increased to %i bps.", baud[arrayCounter][1]);
     } else {
       MsgTS("  " STR_BAUD_CONTROL "Baud rate cannot go beyond 4800 bps.");
     }
@@ -78,13 +101,34 @@ void decreaseBaud(void)
     if(arrayCounter>0){
     arrayCounter--;
     cycles = baud[arrayCounter][0];
-            sprintf(strTmp, "  " STR_BAUD_CONTROL "Baud rate decreased to %i bps.", baud[arrayCounter][1]);
-            MsgTS(strTmp);
+            MsgTSf("  " STR_BAUD_CONTROL "Baud rate decreased to %i bps.", baud[arrayCounter][1]);
     } else {
       MsgTS("  " STR_BAUD_CONTROL "Baud rate cannot go below 1200 bps.");
     }
 }
 
+/**
+setBaud()
+
+Sets the baud rate directly, for "baud N" in UI.
+
+@param  rate is one of the rates in baud[][].
+@return 0, or -1 if rate is not supported.
+*/
+int setBaud(unsigned int rate)
+{
+    unsigned int k;
+
+    for (k = 0; k < 3; k++) {
+      if ((unsigned int) baud[k][1] == rate) {
+        arrayCounter = k;
+        cycles = baud[k][0];
+        return 0;
+      }
+    }
+    return -1;
+}
+
 /**
 baudControl()
 
@@ -92,23 +136,298 @@ Calls the carrier wave loop [modDelay()] 'cycles' number of times.
 After each call, P2 bits are flipped to generate a 38.4 kHz square carrier wave.
 Four P2 bits are flipped since the accompanying circuit requires each LED to have its own carrier wave.
 
+With neither feature on, the bench-tuned loop runs unchanged. With carrier suppression on,
+lanes sending CARRIER_IDLE_LEVEL keep their P2 bit low for the whole bit; that loop toggles
+a computed set of pins, so its timing may differ from the constant toggles by a cycle or two.
+If any side's duty cycle is below 50%, the bit is sent by shapedCarrier() instead.
+
 baudControl() is called in by TaskDriver() before it loops again to change the P5 ASCII signals.
 While baudControl() is working, all P5 signals maintain their state.
+
+@param  lanes is the value just written to P5OUT.
 */
-void baudControl( void )        
+void baudControl( unsigned char lanes )
 {
+    unsigned char pins = CARRIER_PINS, low, high;
+
+    if (!suppress && !shaped) {
+      delay=cycles;
+      do {
+         modDelay();
+
+         // P2 bits toggled in two steps so that the loop takes ~26 micro s (~34.8 kHz).
+         // Empirically determined.
+         P2OUT ^= BIT1+BIT3;                // Toggles P2.1 and P2.3
+         P2OUT ^= BIT5+BIT7;                // Toggles P2.5 and P2.7
+      } while (delay--);
+      return;
+    }
+
+    if (suppress) {
+      pins = lanePins[(CARRIER_IDLE_LEVEL ? ~lanes : lanes) & SIDE_MASK];
+      P2OUT &= ~CARRIER_PINS | pins;      // Suppressed lanes dark
+    }
+#if CARRIER_SHAPING
+    if (shaped) {
+      shapedCarrier(pins);
+      return;
+    }
+#endif
+    low  = pins & (BIT1 + BIT3);
+    high = pins & (BIT5 + BIT7);
+
     delay=cycles;
     do {
        modDelay();
-
-       // P2 bits toggled in two steps so that the loop takes ~26 micro s (~34.8 kHz).
-       // Empirically determined.
-       P2OUT ^= BIT1 + BIT3;              // Toggles P2.1 and P2.3
-       P2OUT ^= BIT5 + BIT7;              // Toggles P2.5 and P2.7  
+       P2OUT ^= low;                      // Toggles P2.1 and P2.3 of lanes with a carrier
+       P2OUT ^= high;                     // Toggles P2.5 and P2.7 of lanes with a carrier
    } while (delay--);
 }
 
 
+#if CARRIER_SHAPING
+/**
+shapedCarrier()
+
+Sends one bit's worth of carrier, CARRIER_PHASES phases per carrier period, with each side's
+P2 bit high for its first dutyPhases[] phases. Takes as long as the baudControl() loop.
+Only the carrier bits of P2OUT are written; the other P2 bits are read back every phase.
+
+@param  pins are the P2 bits allowed to carry the carrier during this bit.
+*/
+static void shapedCarrier( unsigned char pins )
+{
+    unsigned int n = (cycles+1) * (CARRIER_PHASES/2);
+    unsigned char ph = 0;
+    unsigned int k;
+
+    do {
+       P2OUT = (P2OUT & ~CARRIER_PINS) | (carrierPattern[ph] & pins);
+       if (++ph == CARRIER_PHASES) {
+         ph = 0;
+       }
+       k = PHASE_CYCLES;
+       do {
+         NOP;
+       } while (k--);
+    } while (--n);
+}
+#endif
+
+
+/**
+setDuty()
+
+Sets the carrier duty cycle of one side and rebuilds the phase pattern.
+The duty cycle is rounded to whole phases, between one phase and 50%.
+Without CARRIER_SHAPING only 50% is accepted.
+
+@param  side is the P5 bit of the side.
+@param  percent is the share of each carrier period the LED is driven.
+@return 0, or -1 if the side does not exist or the duty cycle cannot be set.
+*/
+int setDuty( unsigned int side, unsigned int percent )
+{
+    unsigned int ph;
+#if CARRIER_SHAPING
+    unsigned int s;
+    unsigned char pattern;
+#endif
+
+    if (side >= SIDES || percent == 0) {
+      return -1;
+    }
+    ph = (percent * CARRIER_PHASES + 50) / 100;
+    if (ph < 1) {
+      ph = 1;
+    } else if (ph > CARRIER_PHASES/2) {
+      ph = CARRIER_PHASES/2;
+    }
+    if (!CARRIER_SHAPING && ph != CARRIER_PHASES/2) {
+      return -1;
+    }
+    dutyPhases[side] = ph;
+
+#if CARRIER_SHAPING
+    shaped = 0;
+    for (s = 0; s < SIDES; s++) {
+      if (dutyPhases[s] != CARRIER_PHASES/2) {
+        shaped = 1;
+      }
+    }
+    for (ph = 0; ph < CARRIER_PHASES; ph++) {
+      pattern = 0;
+      for (s = 0; s < SIDES; s++) {
+        if (ph < dutyPhases[s]) {
+          pattern |= lanePins[1<<s];
+        }
+      }
+      carrierPattern[ph] = pattern;
+    }
+#endif
+    return 0;
+}
+
+
+/**
+initCarrier()
+
+Sets every side's duty cycle to its CARRIER_DUTY default.
+Called in by TaskDriver() at startup, once P2 is configured.
+*/
+void initCarrier( void )
+{
+    static const unsigned char duty[SIDES] = CARRIER_DUTY;
+    unsigned int s;
+
+    for (s = 0; s < SIDES; s++) {
+      setDuty(s, duty[s]);
+    }
+}
+
+
+#if CARRIER_SHAPING
+/**
+cycleDuty()
+
+Steps every side's carrier duty cycle through 50%, 33% and 25%, when the user presses 'd' in UI.
+*/
+void cycleDuty( void )
+{
+    unsigned int s, percent;
+
+    switch (dutyPhases[0]) {
+      case CARRIER_PHASES/2: percent = 33; break;
+      case CARRIER_PHASES/3: percent = 25; break;
+      default:               percent = 50; break;
+    }
+    for (s = 0; s < SIDES; s++) {
+      setDuty(s, percent);
+    }
+    MsgTSf("  " STR_BAUD_CONTROL "Carrier duty cycle %u%% on all sides.", percent);
+}
+#endif
+
+
+/**
+toggleSuppress()
+
+Switches carrier suppression on idle lanes on and off, when the user presses 'i' in UI.
+The LEDs of a lane at a mark are dark either way (see CARRIER_IDLE_LEVEL); suppression only
+stops its carrier pin from switching.
+*/
+void toggleSuppress( void )
+{
+    suppress ^= 1;
+    if (suppress) {
+      MsgTS("  " STR_BAUD_CONTROL "Carrier suppressed on idle lanes.");
+    } else {
+      MsgTS("  " STR_BAUD_CONTROL "Carrier on all lanes.");
+    }
+}
+
+
+/**
+setSides()
+
+Switches the carrier of each side on or off at once, for "sides M" in UI: bit n of the mask
+enables side n (P5.n), as the '1'-'4' toggles do one pin at a time.
+
+@param  mask holds the sides to enable.
+@return 0, or -1 if mask has bits beyond SIDE_MASK.
+*/
+int setSides( unsigned int mask )
+{
+    if (mask & ~SIDE_MASK) {
+      return -1;
+    }
+    P2DIR = (P2DIR & ~CARRIER_PINS) | lanePins[mask];
+    return 0;
+}
+
+
+/**
+signalStatus()
+
+Appends the carrier settings to a "status" line in UI: baud rate, enabled sides, duty cycle
+of each side in phases of CARRIER_PHASES, and idle-lane suppression.
+
+@param  s is the end of the line being built.
+*/
+void signalStatus( char *s )
+{
+    unsigned int m, mask = 0;
+
+    for (m = 0; m < SIDES; m++) {
+      if (P2DIR & lanePins[1<<m]) {
+        mask |= 1 << m;
+      }
+    }
+    sprintf(s, " baud=%u sides=%X d=%u/%u/%u/%u i=%u", baud[arrayCounter][1], mask,
+            dutyPhases[0], dutyPhases[1], dutyPhases[2], dutyPhases[3], suppress);
+}
+
+
+/**
+ledAccount()
+
+Adds the LED on-time of one transmitted frame. A side's LED is driven for dutyPhases[] of
+the CARRIER_PHASES phases in each carrier period of every space bit, if its P2 bit is
+enabled (P2DIR). At a mark (CARRIER_IDLE_LEVEL) the lane holds the LED dark whether or not
+the carrier is suppressed. Called in by TaskDriver() after each frame, outside the timed
+transmission.
+
+@param  frame is the FRAME_BITS array just sent.
+@param  idle holds the lanes that were forced idle (TDMA).
+*/
+void ledAccount( const char *frame, unsigned char idle )
+{
+    unsigned int s, i, driven;
+
+    for (s = 0; s < SIDES; s++) {
+      if (!(P2DIR & lanePins[1<<s])) {
+        continue;                         // Carrier switched off ('1'-'4', "sides")
+      }
+      driven = 0;
+      for (i = 0; i < FRAME_BITS; i++) {
+        if ((((frame[i] | idle) >> s) & 1) != CARRIER_IDLE_LEVEL) {
+          driven++;
+        }
+      }
+      ledOnPhases[s] += (unsigned long) driven * ((cycles+1)/2) * dutyPhases[s];
+    }
+}
+
+
+/**
+ledReport()
+
+Prints each side's estimated LED on-time in ms per second since the last report, when the
+user presses 'l' in UI, and starts a new measurement.
+*/
+void ledReport( void )
+{
+    OStypeTick now = OSGetTicks();
+    unsigned long elapsed = (unsigned long) (now - ledSince);
+    unsigned int s, on[SIDES];
+
+    if (elapsed == 0) {
+      elapsed = 1;
+    }
+    // One tick is 10 ms: tenths of ms per second
+    for (s = 0; s < SIDES; s++) {
+      on[s] = (unsigned int) (ledOnPhases[s] / elapsed * CARRIER_PHASE_NS / 1000);
+      ledOnPhases[s] = 0;
+    }
+    ledSince = now;
+    MsgTSf("  " STR_BAUD_CONTROL "LED on-time (ms/s): '%c' %u.%u '%c' %u.%u '%c' %u.%u '%c' %u.%u",
+            sideChars[0], on[0]/10, on[0]%10, sideChars[1], on[1]/10, on[1]%10,
+            sideChars[2], on[2]/10, on[2]%10, sideChars[3], on[3]/10, on[3]%10);
+    MsgTSf("  Duty %u/%u/%u/%u of %u phases, idle carrier %s.", dutyPhases[0], dutyPhases[1],
+            dutyPhases[2], dutyPhases[3], CARRIER_PHASES, suppress ? "suppressed" : "on");
+}
+
+
 /**
 modDelay()
 
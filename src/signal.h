@@ -11,12 +11,43 @@
 
 extern void increaseBaud( void );
 extern void decreaseBaud( void );
-extern void baudControl( void );
+extern int setBaud( unsigned int rate );
+extern int setSides( unsigned int mask );
+extern void signalStatus( char *s );
+extern void baudControl( unsigned char lanes );
 extern void modDelay( void );
+extern void initCarrier( void );
+extern int setDuty( unsigned int side, unsigned int percent );
+extern void cycleDuty( void );
+extern void toggleSuppress( void );
+extern void ledAccount( const char *frame, unsigned char idle );
+extern void ledReport( void );
 
 #define STR_BAUD_CONTROL      "BaudControl:\t"
 
 // Empirically determined number of NOP cycles required for a 38.4 kHz frequency
 #define MOD_CYCLES             5
 
+// Carrier shaping: a carrier period (two baudControl() loops, ~52 micro s) is split into
+// CARRIER_PHASES phases, so that 25%, 33% and 50% duty cycles are whole numbers of phases.
+// PHASE_CYCLES is the NOP count that makes one phase ~4.34 micro s; it depends on the code
+// the compiler emits for the shapedCarrier() loop, so measure it on the bench as MOD_CYCLES
+// was. Until then CARRIER_SHAPING stays 0: every side keeps the 50% carrier, and neither
+// the shaped loop nor the 'd' and "width" commands are built.
+#define CARRIER_SHAPING        0
+#define CARRIER_PHASES         12
+#define CARRIER_PHASE_NS       4340
+#define PHASE_CYCLES           3
+#define CARRIER_PINS           (BIT1+BIT3+BIT5+BIT7)
+
+// Default duty cycle of each side's carrier in percent, P5.0 first
+#define CARRIER_DUTY           { 50, 50, 50, 50 }
+
+// Lane level at which a side's LEDs are dark: a mark (1). The receiver outputs a space while
+// it sees the carrier, so the start bit (0 in LEDarray) lights the LEDs; the carrier pins
+// toggle on every bit, so the LED circuit gates them with the lane. Stop bits, lanes held
+// idle by TDMA and P5 between frames are marks. Suppression ('i') keeps the carrier pins of
+// such lanes low: that saves pin switching, not LED current.
+#define CARRIER_IDLE_LEVEL     1
+
 #endif /* __SIGNAL_H */
@@ -6,15 +6,295 @@
 * @note Only one of the two initialized UARTs - UART0 - has been configured here for communication.
 */
 
-#include <salvo.h>                // Req'd because we call e.g. OS_WaitSem() 
+#include <salvo.h>                // Req'd because we call e.g. OS_WaitBinSem() 
 #include <usart_uart.h>           // Req'd because we call usart_uart0_getchar()
 #include <ctype.h>                // Req'd because we call tolower()
+#include <string.h>               // Req'd because we call strchr() and strcmp()
+#include <stdlib.h>               // Req'd because we call strtoul()
 
 #include "main.h"                 // Application header
 #include "ui.h"                   // Good to self-reference
 #include "msg.h"                  // Req'd because we call MsgTS()
-#include "signal.h"               // Req'd because we call increaseBaud() and decreaseBaud()
+#include "signal.h"               // Req'd because we call increaseBaud(), setBaud() and setDuty()
 #include "counter.h"              // Req'd because we call returnCount()
+#include "pool.h"                 // Req'd because we call PoolGet(), PoolReport(), PoolDropped() and use rx1Level
+#include "driver.h"               // Req'd because we call togglePRBS(), setGap() and use sideChars[]
+
+// Line being received, and whether it outgrew line[]
+static char line[UI_LINE_SIZE];
+static unsigned char lineLen, lineLost;
+
+// Set by 'r'; the restart waits until TaskUI() can call OS_Delay()
+static unsigned char resetPending;
+
+/**
+letterCommand()
+
+Runs one single-letter command (see TaskUI()).
+
+@param  cmd is the letter, in either case.
+*/
+static void letterCommand ( unsigned char cmd )
+{
+  // Converts all characters to lower case
+  switch (tolower(cmd)) {   
+
+    // Counter
+   case 'c':
+      MsgTSf(STR_TASK_UI "%c: Counter: %2u signal blocks have been transmitted.",cmd,returnCount());
+      break;
+
+    // Increase baud rate
+    case 'a':
+      MsgTSf(STR_TASK_UI "%c: Increasing baud rate...",cmd);
+      increaseBaud();
+      break;
+
+    // Decrease baud rate
+    case 'z':
+      MsgTSf(STR_TASK_UI "%c: Decreasing baud rate...",cmd);
+      decreaseBaud();
+      break;
+
+    /*=====================================================================
+     * The following four commands toggle carrier waves at for P2.x ports. 
+     * Since the receiver's filter only allows 38.4 kHz modulated waves to  
+     * pass through, the ASCII signals are effectively blocked when their 
+     * corresponding P2.x ports no longer deliver a 38.4 kHz square wave.
+    =====================================================================*/
+
+    // Toggles port 2.1; Blocks ASCII signal at port 5.1
+    case '1':
+      P2DIR ^= BIT1;
+      MsgTSf(STR_TASK_UI "%c: P2.1: Carrier wave for '%c' toggled",cmd,sideChars[1]);
+      break;
+
+    // Toggles port 2.3; Blocks ASCII signal at port 5.0
+    case '2':
+      P2DIR ^= BIT3;
+      MsgTSf(STR_TASK_UI "%c: P2.3: Carrier wave for '%c' toggled",cmd,sideChars[0]);
+      break;
+
+    // Toggles port 2.5; Blocks ASCII signal at port 5.3
+    case '3':
+      P2DIR ^= BIT5;
+      MsgTSf(STR_TASK_UI "%c: P2.5: Carrier wave for '%c' toggled",cmd,sideChars[3]);
+      break;
+
+    // Toggles port 2.7; Blocks ASCII signal at port 5.2 
+    case '4':
+      P2DIR ^= BIT7;
+      MsgTSf(STR_TASK_UI "%c: P2.7: Carrier wave for '%c' toggled",cmd,sideChars[2]);
+      break;
+
+    // PRBS test mode
+    case 'p':
+      MsgTSf(STR_TASK_UI "%c: Toggling PRBS test frames...",cmd);
+      togglePRBS();
+      break;
+
+    // Trace reports
+    case 'e':
+      MsgTSf(STR_TASK_UI "%c: Toggling trace reports...",cmd);
+      toggleTrace();
+      break;
+
+    // TDMA mode
+    case 't':
+      MsgTSf(STR_TASK_UI "%c: Toggling TDMA slots...",cmd);
+      toggleTDMA();
+      break;
+
+#if CARRIER_SHAPING
+    // Carrier duty cycle
+    case 'd':
+      MsgTSf(STR_TASK_UI "%c: Changing carrier duty cycle...",cmd);
+      cycleDuty();
+      break;
+#endif
+
+    // Carrier suppression on idle lanes
+    case 'i':
+      MsgTSf(STR_TASK_UI "%c: Toggling idle-lane carrier...",cmd);
+      toggleSuppress();
+      break;
+
+    // LED on-time telemetry
+    case 'l':
+      MsgTSf(STR_TASK_UI "%c: LED on-time:",cmd);
+      ledReport();
+      break;
+
+    // Memory high-water marks
+    case 'm':
+      MsgTSf(STR_TASK_UI "%c: Memory high-water marks:",cmd);
+      PoolReport();
+      break;
+
+    // Version 
+    case 'v':
+      MsgTSf(STR_TASK_UI "%c: Version: " VERSION_NUM STR_VERSION,cmd);
+      break;
+    
+    // Reset
+    case 'r':
+      MsgTSf(STR_TASK_UI "%c: Resetting.",cmd);
+      resetPending = 1;  // TaskUI() restarts once the pending input is handled
+      break;
+
+    // Help 
+    case 'h':
+      // One message per group: each must fit in a pool block
+      MsgTSf(STR_TASK_UI "%c: Allowed Commands: \r\n c:counter \r\n a:increase baud rate \r\n z:decrease baud rate",cmd);
+      MsgTSf("  1:toggle signal '%c' \r\n 2:toggle signal '%c' \r\n 3:toggle signal '%c' \r\n 4:toggle signal '%c'",
+             sideChars[1],sideChars[0],sideChars[3],sideChars[2]);
+      MsgTS("  v:version \r\n r:reset \r\n h:help \r\n m:memory");   // Note indent of two spaces
+      MsgTS("  p:PRBS test frames");
+      MsgTS("  e:trace reports");
+      MsgTS("  t:TDMA slots");
+#if CARRIER_SHAPING
+      MsgTS("  d:carrier duty cycle \r\n i:idle-lane carrier \r\n l:LED on-time");
+      MsgTS("  Lines: baud N, gap N, slot N, guard N, sides M, width S P, status; \r\n ';' between, Enter ends.");
+#else
+      MsgTS("  i:idle-lane carrier \r\n l:LED on-time");
+      MsgTS("  Lines: baud N, gap N, slot N, guard N, sides M, status; \r\n ';' between, Enter ends.");
+#endif
+      break;
+
+    // invalid command
+    default:
+      MsgTS("Invalid command. Type h for help.");
+      break;
+
+  }
+}
+
+
+/**
+statusReport()
+
+Prints every counter and setting for "status", on two lines so each fits a pool block:
+"status n=<frames> gap=<ticks> p=<PRBS> e=<trace> t=<TDMA> slot=<frames> guard=<ticks>
+sf=<superframe>" and "status baud=<bps> sides=<mask> d=<duty phases per side>
+i=<idle suppression> drop=<messages dropped>".
+*/
+static void statusReport ( void )
+{
+  char *s;
+
+  if ((s = PoolGet(POOL_OWNER_MSG)) == 0) {
+    return;
+  }
+  sprintf(s, STR_TASK_UI "status n=%u", returnCount());
+  driverStatus(s + strlen(s));
+  MsgTS(s);
+  strcpy(s, STR_TASK_UI "status");
+  signalStatus(s + strlen(s));
+  sprintf(s + strlen(s), " drop=%u", PoolDropped());
+  MsgTS(s);
+  PoolPut(s);
+}
+
+
+/**
+wordCommand()
+
+Runs one command of a line: a single letter, "status", or a set command with a number
+(decimal, or hex with 0x), two for "width" (built with CARRIER_SHAPING only). A set
+command answers with one short line.
+
+@param  cmd is the command, lower case, without surrounding spaces.
+*/
+static void wordCommand ( char *cmd )
+{
+  char *arg, *end;
+  unsigned long n;
+#if CARRIER_SHAPING
+  char *p;
+  unsigned long pct;
+#endif
+  int rc, (*set)(unsigned int);
+
+  // Split off the argument
+  for (arg = cmd; *arg && *arg != ' '; arg++);
+  if (*arg) {
+    *arg++ = '\0';
+  }
+  while (*arg == ' ') {
+    arg++;
+  }
+
+  if (cmd[1] == '\0' && *arg == '\0') {
+    letterCommand(cmd[0]);
+    return;
+  }
+  if (strcmp(cmd, "status") == 0 && *arg == '\0') {
+    statusReport();
+    return;
+  }
+#if CARRIER_SHAPING
+  if (strcmp(cmd, "width") == 0) {
+    n = strtoul(arg, &end, 0);
+    pct = strtoul(p = end, &end, 0);
+    rc = (end == p || *end != '\0' || n >= SIDES || pct > 100) ? -1 : setDuty((unsigned int) n, (unsigned int) pct);
+    MsgTSf(STR_TASK_UI "%s %s: %s", cmd, arg, rc ? "Rejected." : "OK.");
+    return;
+  }
+#endif
+
+  if (strcmp(cmd, "baud") == 0) {
+    set = setBaud;
+  } else if (strcmp(cmd, "gap") == 0) {
+    set = setGap;
+  } else if (strcmp(cmd, "slot") == 0) {
+    set = setSlot;
+  } else if (strcmp(cmd, "guard") == 0) {
+    set = setGuard;
+  } else if (strcmp(cmd, "sides") == 0) {
+    set = setSides;
+  } else {
+    MsgTSf(STR_TASK_UI "%s: Invalid command. Type h for help.", cmd);
+    return;
+  }
+  n = strtoul(arg, &end, 0);
+  if (end == arg || *end != '\0' || n > 0xFFFF) {
+    rc = -1;
+  } else {
+    rc = set((unsigned int) n);
+  }
+  MsgTSf(STR_TASK_UI "%s %s: %s", cmd, arg, rc ? "Rejected." : "OK.");
+}
+
+
+/**
+lineCommand()
+
+Runs the ';'-separated commands of a complete line, in order.
+
+@param  s is the line, without its end.
+*/
+static void lineCommand ( char *s )
+{
+  char *next, *p;
+
+  for (p = s; *p; p++) {
+    *p = tolower(*p);
+  }
+  for (; s; s = next) {
+    if ((next = strchr(s, ';')) != 0) {
+      *next++ = '\0';
+    }
+    while (*s == ' ') {
+      s++;
+    }
+    for (p = s + strlen(s); p > s && p[-1] == ' '; p--);
+    *p = '\0';
+    if (*s) {
+      wordCommand(s);
+    }
+  }
+}
+
 
 /**
 TaskUI()
@@ -22,7 +302,7 @@ TaskUI()
 @brief User interface task running at 9600 bps
 
 The user interface task handles commands received through the USB connection. 
-The available commands are:
+The available single-letter commands are:
  - c: Counter (prints number of signal blocks transmitted)
  - a: Increase Baud Rate (via signal.c; prints new baud rate)
  - z: Decrease Baud Rate (via signal.c; prints new baud rate)
@@ -30,13 +310,37 @@ The available commands are:
  - 2: Toggles port 2.3 (blocks ASCII signal at port 5.0)
  - 3: Toggles port 2.5 (blocks ASCII signal at port 5.3)
  - 4: Toggles port 2.7 (blocks ASCII signal at port 5.2)
+ - p: PRBS test frames on/off (via driver.c; for bit-error-rate measurement)
+ - e: Trace reports on/off (via driver.c; for end-to-end latency measurement)
+ - t: TDMA slots on/off (via driver.c; one side at a time, for clean corner views)
+ - d: Carrier duty cycle 50%/33%/25% (via signal.c; trades link margin for LED power;
+      only with CARRIER_SHAPING)
+ - i: Carrier pins of lanes at a mark held low/toggling (via signal.c)
+ - l: LED on-time telemetry (via signal.c; ms per second per side since last 'l')
+ - m: Memory (via pool.c; prints stack and buffer high-water marks)
  - v: Version (prints version information)
  - r: Reset (via WDT)
  - h: Help (prints list of available commands)
 
-A Semaphore (SEM_UI_P) is used to implement an event driven architecture. 
-The semaphore is signaled in the receiving ISR, ISRRx0().
-The user interface task waits for the semaphore.
+A letter typed at the start of a line runs at once, as it always has. Anything else is
+collected into a line, ended by CR or LF, holding commands separated by ';':
+ - baud N:  Sets the baud rate to 1200, 2400 or 4800 bps (via signal.c)
+ - gap N:   Sets the ticks between frames, 1 to GAP_TICKS_MAX (via driver.c)
+ - slot N:  Sets the frames per TDMA slot, 1 to TDMA_SLOT_FRAMES_MAX (via driver.c)
+ - guard N: Sets the silent ticks after each TDMA slot, 0 to TDMA_GUARD_TICKS_MAX (via driver.c)
+ - sides M: Enables the carrier of side n for each bit n of M, e.g. 0xF (via signal.c)
+ - width S P: Sets the carrier duty cycle of side S (P5.S) to P percent (via signal.c;
+              only with CARRIER_SHAPING)
+ - status:  Prints every counter and setting, on two lines
+ - any single-letter command above
+e.g. "baud 4800;gap 2;sides 0x5;status". Words must not start with a command letter, or
+the letter runs at once.
+
+A binary Semaphore (SEM_UI_CHAR_P) is used to implement an event driven architecture. 
+The semaphore is signaled in the receiving ISR, ISRRx1(), and stays set however many
+characters arrive. The user interface task waits for the semaphore, then handles every
+character received since, so a burst of input costs one wake (two if the burst is still
+arriving while it drains).
 */
 void TaskUI ( void )
 {
@@ -47,97 +351,36 @@ void TaskUI ( void )
   // Main loop for TaskUI
   while (1) {
     // Wait for a new command
-    OS_WaitSem(SEM_UI_CHAR_P, OSNO_TIMEOUT);
-    
-    if (cmd=usart_uart1_getchar()) {
-      
-      // Converts all characters to lower case
-      switch (tolower(cmd)) {   
-
-        // Counter
-       case 'c':
-          sprintf(strTmp, STR_TASK_UI "%c: Counter: %2u signal blocks have been transmitted.",cmd,returnCount());
-          MsgTS(strTmp);
-          break;
-
-        // Increase baud rate
-        case 'a':
-          sprintf(strTmp, STR_TASK_UI "%c: Increasing baud rate...",cmd);
-          MsgTS(strTmp);
-          increaseBaud();
-          break;
-
-        // Decrease baud rate
-        case 'z':
-          sprintf(strTmp, STR_TASK_UI "%c: Decreasing baud rate...",cmd);
-          MsgTS(strTmp);
-          decreaseBaud();
-          break;
-
-        /*=====================================================================
-         * The following four commands toggle carrier waves at for P2.x ports. 
-         * Since the receiver's filter only allows 38.4 kHz modulated waves to  
-         * pass through, the ASCII signals are effectively blocked when their 
-         * corresponding P2.x ports no longer deliver a 38.4 kHz square wave.
-        =====================================================================*/
-
-        // Toggles port 2.1; Blocks ASCII signal at port 5.1
-        case '1':
-          P2DIR ^= BIT1;
-          sprintf(strTmp, STR_TASK_UI "%c: P2.1: Carrier wave for 'c' toggled",cmd);
-          MsgTS(strTmp);
-          break;
-
-        // Toggles port 2.3; Blocks ASCII signal at port 5.0
-        case '2':
-          P2DIR ^= BIT3;
-          sprintf(strTmp, STR_TASK_UI "%c: P2.3: Carrier wave for 'x' toggled",cmd);
-          MsgTS(strTmp);
-          break;
-
-        // Toggles port 2.5; Blocks ASCII signal at port 5.3
-        case '3':
-          P2DIR ^= BIT5;
-          sprintf(strTmp, STR_TASK_UI "%c: P2.5: Carrier wave for 'M' toggled",cmd);
-          MsgTS(strTmp);
-          break;
-
-        // Toggles port 2.7; Blocks ASCII signal at port 5.2 
-        case '4':
-          P2DIR ^= BIT7;
-          sprintf(strTmp, STR_TASK_UI "%c: P2.7: Carrier wave for 'V' toggled",cmd);
-          MsgTS(strTmp);
-          break;
-
-        // Version 
-        case 'v':
-          sprintf(strTmp, STR_TASK_UI "%c: Version: " VERSION_NUM STR_VERSION,cmd);
-          MsgTS(strTmp);
-          break;
-        
-        // Reset
-        case 'r':
-          sprintf(strTmp, STR_TASK_UI "%c: Resetting.",cmd);
-          MsgTS(strTmp);
-          OS_Delay(100);   // waits one second before initiating restart
-          P1OUT |=  BIT7;  // 'close' USB before restarting -- makes restarts much cleaner w/respect to USB
-          P1DIR &= ~BIT7;  //   "
-          WDTCTL = 0xDEAD; // forced restart
-          break;
-
-        // Help 
-        case 'h':
-          sprintf(strTmp, STR_TASK_UI "%c: Allowed Commands: \r\n c:counter \r\n a:increase baud rate \r\n z:decrease baud rate \r\n 1:toggle signal 'c' \r\n 2:toggle signal 'x' \r\n 3:toggle signal 'M' \r\n 4:toggle signal 'V' \r\n v:version \r\n r:reset \r\n h:help",cmd);
-          MsgTS(strTmp);
-          break;
-
-        // invalid command
-        default:
-          MsgTS("Invalid command. Type h for help.");
-          break;
-      
+    OS_WaitBinSem(SEM_UI_CHAR_P, OSNO_TIMEOUT);
+
+    // Drain the receive buffer
+    while ((cmd = usart_uart1_getchar()) != 0) {
+      rx1Level--;
+
+      if (cmd == '\r' || cmd == '\n') {
+        if (lineLost) {
+          MsgTS(STR_TASK_UI "Line too long.");
+        } else if (lineLen) {
+          line[lineLen] = '\0';
+          lineCommand(line);
+        }
+        lineLen = 0;
+        lineLost = 0;
+      } else if (lineLen == 0 && !lineLost && strchr(UI_LETTERS, tolower(cmd))) {
+        letterCommand(cmd);
+      } else if (lineLen < UI_LINE_SIZE-1) {
+        line[lineLen++] = cmd;
+      } else {
+        lineLost = 1;
       }
     }
+
+    // Reset
+    if (resetPending) {
+      OS_Delay(100);   // waits one second before initiating restart
+      P1OUT |=  BIT7;  // 'close' USB before restarting -- makes restarts much cleaner w/respect to USB
+      P1DIR &= ~BIT7;  //   "
+      WDTCTL = 0xDEAD; // forced restart
+    }
   }
 }
-
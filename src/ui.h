@@ -14,4 +14,10 @@ extern void TaskUI(void);
 
 #define STR_TASK_UI       "TaskUI:\t"
 
+// Single-letter commands, run as soon as they are typed at the start of a line
+#define UI_LETTERS        "cazp1234etdilmvrh"
+
+// Longest command line, including its terminating null
+#define UI_LINE_SIZE      48
+
 #endif /* __UI_H */